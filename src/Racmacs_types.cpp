@@ -1,5 +1,6 @@
 
 #include <RcppArmadillo.h>
+#include <unordered_map>
 #include "acmap_optimization.h"
 #include "acmap_titers.h"
 #include "acmap_map.h"
@@ -322,6 +323,19 @@ SEXP wrap(const NoisyBootstrapOutput& noisybootstrapout){
 
 }
 
+// Noisy bootstrap repeat results
+template <>
+SEXP wrap(const NoisyBootstrapRepeats& noisybootstraprepeats){
+
+  return wrap(
+    List::create(
+      _["ag_noise"] = noisybootstraprepeats.ag_noise,
+      _["coords"] = noisybootstraprepeats.coords
+    )
+  );
+
+}
+
 // Stress blob results 2d
 template <>
 SEXP wrap(const StressBlobGrid& blobgrid){
@@ -364,14 +378,21 @@ std::string as(SEXP sxp){
 template <>
 AcOptimizerOptions as(SEXP sxp){
 
+  // A seed is only set where random numbers are needed
   List opt = as<List>(sxp);
+  unsigned int seed = Rf_isNull(opt["seed"]) ? 0 : as<unsigned int>(opt["seed"]);
   return AcOptimizerOptions{
     opt["dim_annealing"],
        opt["method"],
           opt["maxit"],
              opt["num_cores"],
                 opt["report_progress"],
-                   opt["progress_bar_length"]
+                   opt["progress_bar_length"],
+                      seed,
+                         opt["prune_runs"],
+                            opt["prune_interval"],
+                               opt["prune_threshold"],
+                                  opt["keep_best_optimizations"]
   };
 
 }
@@ -396,12 +417,28 @@ AcTiterTable as(SEXP sxp){
     num_sr
   );
 
-  for(int ag=0; ag<num_ags; ag++){
-    for(int sr=0; sr<num_sr; sr++){
-      titertable.set_titer_string(
-        ag, sr,
-        as<std::string>(titers(ag,sr))
-      );
+  // R keeps a single copy of each distinct string, so each titer string is
+  // parsed once and cached by its address
+  std::unordered_map<SEXP, AcTiter> parsed_titers;
+  SEXP last_string = NULL;
+  AcTiter last_titer;
+
+  for(int sr=0; sr<num_sr; sr++){
+    for(int ag=0; ag<num_ags; ag++){
+      SEXP titerstring = STRING_ELT(titers, ag + sr*num_ags);
+      if(titerstring != last_string){
+        auto found = parsed_titers.find(titerstring);
+        if(found == parsed_titers.end()){
+          if(!parse_titer(CHAR(titerstring), last_titer)){
+            last_titer = AcTiter(std::string(CHAR(titerstring)));
+          }
+          parsed_titers.emplace(titerstring, last_titer);
+        } else {
+          last_titer = found->second;
+        }
+        last_string = titerstring;
+      }
+      titertable.set_titer_unchecked(ag, sr, last_titer);
     }
   }
 
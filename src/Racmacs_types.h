@@ -78,6 +78,10 @@ namespace Rcpp {
   template <>
   SEXP wrap(const NoisyBootstrapOutput& noisybootstrapout);
 
+  // Noisy bootstrap repeat results
+  template <>
+  SEXP wrap(const NoisyBootstrapRepeats& noisybootstraprepeats);
+
   // Stress blob results 2d
   template <>
   SEXP wrap(const StressBlobGrid& blobgrid);
@@ -52,7 +52,7 @@ AcOptimization ac_set_sr_coords(
 // [[Rcpp::export]]
 AcOptimization ac_align_optimization(
   AcOptimization source_optimization,
-  const AcOptimization target_optimization
+  const AcOptimization &target_optimization
 ){
 
   source_optimization.alignToOptimization(target_optimization);
@@ -88,7 +88,7 @@ std::vector<AcOptimization> ac_align_optimizations(
   std::vector<AcOptimization> optimizations
 ){
 
-  align_optimizations(optimizations);
+  align_optimizations(optimizations, 1);
   return optimizations;
 
 }
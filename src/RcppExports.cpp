@@ -66,13 +66,13 @@ BEGIN_RCPP
 END_RCPP
 }
 // ac_align_optimization
-AcOptimization ac_align_optimization(AcOptimization source_optimization, const AcOptimization target_optimization);
+AcOptimization ac_align_optimization(AcOptimization source_optimization, const AcOptimization& target_optimization);
 RcppExport SEXP _Racmacs_ac_align_optimization(SEXP source_optimizationSEXP, SEXP target_optimizationSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< AcOptimization >::type source_optimization(source_optimizationSEXP);
-    Rcpp::traits::input_parameter< const AcOptimization >::type target_optimization(target_optimizationSEXP);
+    Rcpp::traits::input_parameter< const AcOptimization& >::type target_optimization(target_optimizationSEXP);
     rcpp_result_gen = Rcpp::wrap(ac_align_optimization(source_optimization, target_optimization));
     return rcpp_result_gen;
 END_RCPP
@@ -974,8 +974,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // ac_dimension_test_map
-DimTestOutput ac_dimension_test_map(AcTiterTable titer_table, arma::uvec dimensions_to_test, double test_proportion, std::string minimum_column_basis, arma::vec fixed_column_bases, int num_optimizations, AcOptimizerOptions options);
-RcppExport SEXP _Racmacs_ac_dimension_test_map(SEXP titer_tableSEXP, SEXP dimensions_to_testSEXP, SEXP test_proportionSEXP, SEXP minimum_column_basisSEXP, SEXP fixed_column_basesSEXP, SEXP num_optimizationsSEXP, SEXP optionsSEXP) {
+DimTestOutput ac_dimension_test_map(AcTiterTable titer_table, arma::uvec dimensions_to_test, double test_proportion, std::string minimum_column_basis, arma::vec fixed_column_bases, int num_optimizations, AcOptimizerOptions options, int replicate_number);
+RcppExport SEXP _Racmacs_ac_dimension_test_map(SEXP titer_tableSEXP, SEXP dimensions_to_testSEXP, SEXP test_proportionSEXP, SEXP minimum_column_basisSEXP, SEXP fixed_column_basesSEXP, SEXP num_optimizationsSEXP, SEXP optionsSEXP, SEXP replicate_numberSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -986,7 +986,8 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< arma::vec >::type fixed_column_bases(fixed_column_basesSEXP);
     Rcpp::traits::input_parameter< int >::type num_optimizations(num_optimizationsSEXP);
     Rcpp::traits::input_parameter< AcOptimizerOptions >::type options(optionsSEXP);
-    rcpp_result_gen = Rcpp::wrap(ac_dimension_test_map(titer_table, dimensions_to_test, test_proportion, minimum_column_basis, fixed_column_bases, num_optimizations, options));
+    Rcpp::traits::input_parameter< int >::type replicate_number(replicate_numberSEXP);
+    rcpp_result_gen = Rcpp::wrap(ac_dimension_test_map(titer_table, dimensions_to_test, test_proportion, minimum_column_basis, fixed_column_bases, num_optimizations, options, replicate_number));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -1031,13 +1032,14 @@ BEGIN_RCPP
 END_RCPP
 }
 // ac_merge_titer_layers
-AcTiterTable ac_merge_titer_layers(const std::vector<AcTiterTable>& titer_layers);
-RcppExport SEXP _Racmacs_ac_merge_titer_layers(SEXP titer_layersSEXP) {
+AcTiterTable ac_merge_titer_layers(const std::vector<AcTiterTable>& titer_layers, const int& num_cores);
+RcppExport SEXP _Racmacs_ac_merge_titer_layers(SEXP titer_layersSEXP, SEXP num_coresSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const std::vector<AcTiterTable>& >::type titer_layers(titer_layersSEXP);
-    rcpp_result_gen = Rcpp::wrap(ac_merge_titer_layers(titer_layers));
+    Rcpp::traits::input_parameter< const int& >::type num_cores(num_coresSEXP);
+    rcpp_result_gen = Rcpp::wrap(ac_merge_titer_layers(titer_layers, num_cores));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -1144,13 +1146,15 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
-// ac_noisy_bootstrap_map
-NoisyBootstrapOutput ac_noisy_bootstrap_map(AcTiterTable titer_table, double ag_noise_sd, double titer_noise_sd, std::string minimum_column_basis, arma::vec fixed_column_bases, int num_optimizations, int num_dimensions, AcOptimizerOptions options);
-RcppExport SEXP _Racmacs_ac_noisy_bootstrap_map(SEXP titer_tableSEXP, SEXP ag_noise_sdSEXP, SEXP titer_noise_sdSEXP, SEXP minimum_column_basisSEXP, SEXP fixed_column_basesSEXP, SEXP num_optimizationsSEXP, SEXP num_dimensionsSEXP, SEXP optionsSEXP) {
+// ac_noisy_bootstrap_repeats
+NoisyBootstrapRepeats ac_noisy_bootstrap_repeats(AcTiterTable titer_table, arma::mat target_coords, int num_repeats, double ag_noise_sd, double titer_noise_sd, std::string minimum_column_basis, arma::vec fixed_column_bases, int num_optimizations, int num_dimensions, AcOptimizerOptions options);
+RcppExport SEXP _Racmacs_ac_noisy_bootstrap_repeats(SEXP titer_tableSEXP, SEXP target_coordsSEXP, SEXP num_repeatsSEXP, SEXP ag_noise_sdSEXP, SEXP titer_noise_sdSEXP, SEXP minimum_column_basisSEXP, SEXP fixed_column_basesSEXP, SEXP num_optimizationsSEXP, SEXP num_dimensionsSEXP, SEXP optionsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< AcTiterTable >::type titer_table(titer_tableSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type target_coords(target_coordsSEXP);
+    Rcpp::traits::input_parameter< int >::type num_repeats(num_repeatsSEXP);
     Rcpp::traits::input_parameter< double >::type ag_noise_sd(ag_noise_sdSEXP);
     Rcpp::traits::input_parameter< double >::type titer_noise_sd(titer_noise_sdSEXP);
     Rcpp::traits::input_parameter< std::string >::type minimum_column_basis(minimum_column_basisSEXP);
@@ -1158,7 +1162,7 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type num_optimizations(num_optimizationsSEXP);
     Rcpp::traits::input_parameter< int >::type num_dimensions(num_dimensionsSEXP);
     Rcpp::traits::input_parameter< AcOptimizerOptions >::type options(optionsSEXP);
-    rcpp_result_gen = Rcpp::wrap(ac_noisy_bootstrap_map(titer_table, ag_noise_sd, titer_noise_sd, minimum_column_basis, fixed_column_bases, num_optimizations, num_dimensions, options));
+    rcpp_result_gen = Rcpp::wrap(ac_noisy_bootstrap_repeats(titer_table, target_coords, num_repeats, ag_noise_sd, titer_noise_sd, minimum_column_basis, fixed_column_bases, num_optimizations, num_dimensions, options));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -1209,8 +1213,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // ac_stress_blob_grid
-StressBlobGrid ac_stress_blob_grid(arma::vec testcoords, arma::mat coords, arma::vec tabledists, arma::uvec titertypes, double stress_lim, double grid_spacing);
-RcppExport SEXP _Racmacs_ac_stress_blob_grid(SEXP testcoordsSEXP, SEXP coordsSEXP, SEXP tabledistsSEXP, SEXP titertypesSEXP, SEXP stress_limSEXP, SEXP grid_spacingSEXP) {
+StressBlobGrid ac_stress_blob_grid(arma::vec testcoords, arma::mat coords, arma::vec tabledists, arma::uvec titertypes, double stress_lim, double grid_spacing, bool adaptive);
+RcppExport SEXP _Racmacs_ac_stress_blob_grid(SEXP testcoordsSEXP, SEXP coordsSEXP, SEXP tabledistsSEXP, SEXP titertypesSEXP, SEXP stress_limSEXP, SEXP grid_spacingSEXP, SEXP adaptiveSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -1220,7 +1224,25 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< arma::uvec >::type titertypes(titertypesSEXP);
     Rcpp::traits::input_parameter< double >::type stress_lim(stress_limSEXP);
     Rcpp::traits::input_parameter< double >::type grid_spacing(grid_spacingSEXP);
-    rcpp_result_gen = Rcpp::wrap(ac_stress_blob_grid(testcoords, coords, tabledists, titertypes, stress_lim, grid_spacing));
+    Rcpp::traits::input_parameter< bool >::type adaptive(adaptiveSEXP);
+    rcpp_result_gen = Rcpp::wrap(ac_stress_blob_grid(testcoords, coords, tabledists, titertypes, stress_lim, grid_spacing, adaptive));
+    return rcpp_result_gen;
+END_RCPP
+}
+// ac_stress_blob_grids
+std::vector<StressBlobGrid> ac_stress_blob_grids(const arma::mat& test_coords, const arma::mat& coords, const arma::mat& tabledists, const arma::umat& titertypes, double stress_lim, double grid_spacing, int num_cores);
+RcppExport SEXP _Racmacs_ac_stress_blob_grids(SEXP test_coordsSEXP, SEXP coordsSEXP, SEXP tabledistsSEXP, SEXP titertypesSEXP, SEXP stress_limSEXP, SEXP grid_spacingSEXP, SEXP num_coresSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const arma::mat& >::type test_coords(test_coordsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type coords(coordsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type tabledists(tabledistsSEXP);
+    Rcpp::traits::input_parameter< const arma::umat& >::type titertypes(titertypesSEXP);
+    Rcpp::traits::input_parameter< double >::type stress_lim(stress_limSEXP);
+    Rcpp::traits::input_parameter< double >::type grid_spacing(grid_spacingSEXP);
+    Rcpp::traits::input_parameter< int >::type num_cores(num_coresSEXP);
+    rcpp_result_gen = Rcpp::wrap(ac_stress_blob_grids(test_coords, coords, tabledists, titertypes, stress_lim, grid_spacing, num_cores));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -1269,14 +1291,51 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// binary_to_acmap
+AcMap binary_to_acmap(std::string filepath, Rcpp::Nullable<Rcpp::IntegerVector> optimization_numbers);
+RcppExport SEXP _Racmacs_binary_to_acmap(SEXP filepathSEXP, SEXP optimization_numbersSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type filepath(filepathSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type optimization_numbers(optimization_numbersSEXP);
+    rcpp_result_gen = Rcpp::wrap(binary_to_acmap(filepath, optimization_numbers));
+    return rcpp_result_gen;
+END_RCPP
+}
+// acmap_to_binary
+void acmap_to_binary(AcMap map, std::string filepath);
+RcppExport SEXP _Racmacs_acmap_to_binary(SEXP mapSEXP, SEXP filepathSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< AcMap >::type map(mapSEXP);
+    Rcpp::traits::input_parameter< std::string >::type filepath(filepathSEXP);
+    acmap_to_binary(map, filepath);
+    return R_NilValue;
+END_RCPP
+}
 // json_to_acmap
-AcMap json_to_acmap(std::string json);
-RcppExport SEXP _Racmacs_json_to_acmap(SEXP jsonSEXP) {
+AcMap json_to_acmap(std::string json, int num_cores);
+RcppExport SEXP _Racmacs_json_to_acmap(SEXP jsonSEXP, SEXP num_coresSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< std::string >::type json(jsonSEXP);
-    rcpp_result_gen = Rcpp::wrap(json_to_acmap(json));
+    Rcpp::traits::input_parameter< int >::type num_cores(num_coresSEXP);
+    rcpp_result_gen = Rcpp::wrap(json_to_acmap(json, num_cores));
+    return rcpp_result_gen;
+END_RCPP
+}
+// json_file_to_acmap
+AcMap json_file_to_acmap(std::string filepath, Rcpp::Nullable<Rcpp::IntegerVector> optimization_numbers, int num_cores);
+RcppExport SEXP _Racmacs_json_file_to_acmap(SEXP filepathSEXP, SEXP optimization_numbersSEXP, SEXP num_coresSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type filepath(filepathSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Nullable<Rcpp::IntegerVector> >::type optimization_numbers(optimization_numbersSEXP);
+    Rcpp::traits::input_parameter< int >::type num_cores(num_coresSEXP);
+    rcpp_result_gen = Rcpp::wrap(json_file_to_acmap(filepath, optimization_numbers, num_cores));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -1292,6 +1351,19 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// acmap_to_json_file
+void acmap_to_json_file(AcMap map, std::string version, std::string filepath, std::string compression);
+RcppExport SEXP _Racmacs_acmap_to_json_file(SEXP mapSEXP, SEXP versionSEXP, SEXP filepathSEXP, SEXP compressionSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< AcMap >::type map(mapSEXP);
+    Rcpp::traits::input_parameter< std::string >::type version(versionSEXP);
+    Rcpp::traits::input_parameter< std::string >::type filepath(filepathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type compression(compressionSEXP);
+    acmap_to_json_file(map, version, filepath, compression);
+    return R_NilValue;
+END_RCPP
+}
 // ac_procrustes
 Procrustes ac_procrustes(arma::mat X, arma::mat Xstar, bool translation, bool dilation);
 RcppExport SEXP _Racmacs_ac_procrustes(SEXP XSEXP, SEXP XstarSEXP, SEXP translationSEXP, SEXP dilationSEXP) {
@@ -1306,6 +1378,21 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// ac_procrustes_batch
+std::vector<Procrustes> ac_procrustes_batch(const std::vector<arma::mat>& Xs, const arma::mat& Xstar, bool translation, bool dilation, const int& num_cores);
+RcppExport SEXP _Racmacs_ac_procrustes_batch(SEXP XsSEXP, SEXP XstarSEXP, SEXP translationSEXP, SEXP dilationSEXP, SEXP num_coresSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::vector<arma::mat>& >::type Xs(XsSEXP);
+    Rcpp::traits::input_parameter< const arma::mat& >::type Xstar(XstarSEXP);
+    Rcpp::traits::input_parameter< bool >::type translation(translationSEXP);
+    Rcpp::traits::input_parameter< bool >::type dilation(dilationSEXP);
+    Rcpp::traits::input_parameter< const int& >::type num_cores(num_coresSEXP);
+    rcpp_result_gen = Rcpp::wrap(ac_procrustes_batch(Xs, Xstar, translation, dilation, num_cores));
+    return rcpp_result_gen;
+END_RCPP
+}
 // ac_align_coords
 arma::mat ac_align_coords(arma::mat source, arma::mat target, bool translation, bool dilation);
 RcppExport SEXP _Racmacs_ac_align_coords(SEXP sourceSEXP, SEXP targetSEXP, SEXP translationSEXP, SEXP dilationSEXP) {
@@ -1473,11 +1560,11 @@ static const R_CallMethodDef CallEntries[] = {
     {"_Racmacs_ac_sr_set_name_abbreviated", (DL_FUNC) &_Racmacs_ac_sr_set_name_abbreviated, 2},
     {"_Racmacs_ac_sr_set_group", (DL_FUNC) &_Racmacs_ac_sr_set_group, 2},
     {"_Racmacs_ac_sr_set_group_levels", (DL_FUNC) &_Racmacs_ac_sr_set_group_levels, 2},
-    {"_Racmacs_ac_dimension_test_map", (DL_FUNC) &_Racmacs_ac_dimension_test_map, 7},
+    {"_Racmacs_ac_dimension_test_map", (DL_FUNC) &_Racmacs_ac_dimension_test_map, 8},
     {"_Racmacs_ac_hemi_test", (DL_FUNC) &_Racmacs_ac_hemi_test, 6},
     {"_Racmacs_ac_match_map_ags", (DL_FUNC) &_Racmacs_ac_match_map_ags, 2},
     {"_Racmacs_ac_match_map_sr", (DL_FUNC) &_Racmacs_ac_match_map_sr, 2},
-    {"_Racmacs_ac_merge_titer_layers", (DL_FUNC) &_Racmacs_ac_merge_titer_layers, 1},
+    {"_Racmacs_ac_merge_titer_layers", (DL_FUNC) &_Racmacs_ac_merge_titer_layers, 2},
     {"_Racmacs_ac_merge_tables", (DL_FUNC) &_Racmacs_ac_merge_tables, 1},
     {"_Racmacs_ac_merge_reoptimized", (DL_FUNC) &_Racmacs_ac_merge_reoptimized, 4},
     {"_Racmacs_ac_merge_frozen_overlay", (DL_FUNC) &_Racmacs_ac_merge_frozen_overlay, 1},
@@ -1486,18 +1573,24 @@ static const R_CallMethodDef CallEntries[] = {
     {"_Racmacs_ac_merge_incremental", (DL_FUNC) &_Racmacs_ac_merge_incremental, 5},
     {"_Racmacs_ac_merge_titers", (DL_FUNC) &_Racmacs_ac_merge_titers, 2},
     {"_Racmacs_ac_move_trapped_points", (DL_FUNC) &_Racmacs_ac_move_trapped_points, 6},
-    {"_Racmacs_ac_noisy_bootstrap_map", (DL_FUNC) &_Racmacs_ac_noisy_bootstrap_map, 8},
+    {"_Racmacs_ac_noisy_bootstrap_repeats", (DL_FUNC) &_Racmacs_ac_noisy_bootstrap_repeats, 10},
     {"_Racmacs_ac_coords_stress", (DL_FUNC) &_Racmacs_ac_coords_stress, 4},
     {"_Racmacs_ac_relax_coords", (DL_FUNC) &_Racmacs_ac_relax_coords, 7},
     {"_Racmacs_ac_runOptimizations", (DL_FUNC) &_Racmacs_ac_runOptimizations, 5},
-    {"_Racmacs_ac_stress_blob_grid", (DL_FUNC) &_Racmacs_ac_stress_blob_grid, 6},
+    {"_Racmacs_ac_stress_blob_grid", (DL_FUNC) &_Racmacs_ac_stress_blob_grid, 7},
+    {"_Racmacs_ac_stress_blob_grids", (DL_FUNC) &_Racmacs_ac_stress_blob_grids, 7},
     {"_Racmacs_numeric_titers", (DL_FUNC) &_Racmacs_numeric_titers, 1},
     {"_Racmacs_log_titers", (DL_FUNC) &_Racmacs_log_titers, 1},
     {"_Racmacs_titer_types_int", (DL_FUNC) &_Racmacs_titer_types_int, 1},
     {"_Racmacs_reduce_matrix_dimensions", (DL_FUNC) &_Racmacs_reduce_matrix_dimensions, 2},
-    {"_Racmacs_json_to_acmap", (DL_FUNC) &_Racmacs_json_to_acmap, 1},
+    {"_Racmacs_binary_to_acmap", (DL_FUNC) &_Racmacs_binary_to_acmap, 2},
+    {"_Racmacs_acmap_to_binary", (DL_FUNC) &_Racmacs_acmap_to_binary, 2},
+    {"_Racmacs_json_to_acmap", (DL_FUNC) &_Racmacs_json_to_acmap, 2},
+    {"_Racmacs_json_file_to_acmap", (DL_FUNC) &_Racmacs_json_file_to_acmap, 3},
     {"_Racmacs_acmap_to_json", (DL_FUNC) &_Racmacs_acmap_to_json, 2},
+    {"_Racmacs_acmap_to_json_file", (DL_FUNC) &_Racmacs_acmap_to_json_file, 4},
     {"_Racmacs_ac_procrustes", (DL_FUNC) &_Racmacs_ac_procrustes, 4},
+    {"_Racmacs_ac_procrustes_batch", (DL_FUNC) &_Racmacs_ac_procrustes_batch, 5},
     {"_Racmacs_ac_align_coords", (DL_FUNC) &_Racmacs_ac_align_coords, 4},
     {"_Racmacs_ac_procrustes_map_coords", (DL_FUNC) &_Racmacs_ac_procrustes_map_coords, 6},
     {"_Racmacs_ac_procrustes_map_data", (DL_FUNC) &_Racmacs_ac_procrustes_map_data, 2},
@@ -4,6 +4,7 @@
 #include "ac_optim_map_stress.h"
 #include "ac_dimension_test.h"
 #include "ac_optimizer_options.h"
+#include "utils_random.h"
 
 // [[Rcpp::export]]
 DimTestOutput ac_dimension_test_map(
@@ -13,21 +14,30 @@ DimTestOutput ac_dimension_test_map(
   std::string minimum_column_basis,
   arma::vec fixed_column_bases,
   int num_optimizations,
-  AcOptimizerOptions options
+  AcOptimizerOptions options,
+  int replicate_number = 0
 ){
 
   // Declare variables
   arma::vec colbases;
 
-  // Silence normal optimization progress reporting
+  // Silence normal optimization progress reporting, and only keep the lowest
+  // stress run of each set of optimizations, without racing runs so that
+  // there is always a run to keep
   options.report_progress = false;
+  options.keep_best_optimizations = 1;
+  options.prune_runs = false;
 
   // Get a random index of measured titers to test
   int num_measured = titer_table.num_measured();
   int num_test = round(num_measured*test_proportion);
 
+  // Each replicate draws from its own random number stream, with the
+  // optimizations drawing from a seed of their own
+  AcRNG rng(options.seed, replicate_number);
   arma::uvec indices_measured = titer_table.vec_indices_measured();
-  arma::uvec sample = arma::randperm( num_measured, num_test );
+  arma::uvec sample = rng.randperm( num_measured, num_test );
+  options.seed = static_cast<unsigned int>(rng.next());
   arma::uvec indices_test = indices_measured.elem( sample );
   arma::umat indices_test_mat = arma::ind2sub( titer_table.size(), indices_test );
 
@@ -65,8 +75,9 @@ DimTestOutput ac_dimension_test_map(
       options
     );
 
-    // Sort by stress and keep lowest stress coords
-    sort_optimizations_by_stress(optimizations);
+    // Find the lowest stress run and keep its coords
+    if(optimizations.empty()) Rcpp::stop("No optimization runs completed");
+    partial_sort_optimizations_by_stress(optimizations, 1);
 
     // Work out predicted titers for each of the test cases
     for(arma::uword j=0; j<predicted_titers.n_elem; j++){
@@ -5,15 +5,25 @@
 #include "acmap_optimization.h"
 #include "utils.h"
 #include "utils_error.h"
-
-std::vector<HemiData> ac_hemi_test_points(
-  arma::mat ag_coords,
-  arma::mat sr_coords,
-  arma::mat tabledists,
-  arma::umat titertypes,
-  double grid_spacing,
-  double stress_lim,
-  AcOptimizerOptions options
+#include "utils_parallel.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+// [[Rcpp::plugins(openmp)]]
+
+// Diagnose hemisphering of a single point, the point is moved within
+// ag_coords while testing but restored before returning, sr_coords are fixed
+// but passed to the relaxation so must be writable
+std::vector<HemiDiagnosis> ac_hemi_test_point(
+  const arma::uword &ag,
+  arma::mat &ag_coords,
+  arma::mat &sr_coords,
+  const arma::mat &tabledists,
+  const arma::umat &titertypes,
+  const double &grid_spacing,
+  const double &stress_lim,
+  const AcOptimizerOptions &options
 ){
 
   // Set variables
@@ -21,129 +31,165 @@ std::vector<HemiData> ac_hemi_test_points(
   arma::uword num_sr = sr_coords.n_rows;
   arma::uword dim = ag_coords.n_cols;
 
-  // Check input
-  if(dim < 2 || dim > 3){
-    ac_error("Hemisphere testing is only supported for 2 or 3 dimensions");
-  }
-
-  // Setup for output
-  std::vector<HemiData> output;
-
   // Set objects to use in loop
-  arma::rowvec hemi_ag_orig_coords( dim );
+  arma::rowvec hemi_ag_orig_coords = ag_coords.row(ag);
   arma::rowvec hemi_ag_improved_coords( dim );
   arma::rowvec hemi_ag_relaxed_coords( dim );
-  arma::uvec fixed_antigens;
-  arma::uvec fixed_sera;
+  std::vector<HemiDiagnosis> hemi_diagnoses;
+
+  // Set other points to be fixed
+  arma::uvec fixed_antigens = arma::regspace<arma::uvec>( 0, num_ags - 1);
+  arma::uvec fixed_sera = arma::regspace<arma::uvec>( 0, num_sr - 1);
+  fixed_antigens.shed_row( ag );
+
+  // Do a grid search
+  StressBlobGrid grid_results = ac_stress_blob_grid(
+    ag_coords.row(ag).as_col(),
+    sr_coords,
+    tabledists.row(ag).as_col(),
+    titertypes.row(ag).as_col(),
+    stress_lim,
+    grid_spacing
+  );
 
-  // Check hemisphering antigens
-  for(arma::uword ag=0; ag<num_ags; ag++){
+  // Get indices of those with lower stress
+  arma::uvec indices = arma::find( grid_results.grid < stress_lim );
 
-    // Get the original ag coords and setup for any hemisphering coords
-    hemi_ag_orig_coords = ag_coords.row(ag);
-    std::vector<HemiDiagnosis> hemi_diagnoses;
+  // For those with lower stress see if they move back to the original position
+  // on relaxing the map
+  for(arma::uword i=0; i<indices.n_elem; i++){
 
-    // Do a grid search
-    StressBlobGrid grid_results = ac_stress_blob_grid(
-      ag_coords.row(ag).as_col(),
-      sr_coords,
-      tabledists.row(ag).as_col(),
-      titertypes.row(ag).as_col(),
-      stress_lim,
-      grid_spacing
-    );
+    // Get the stress diff
+    double stress_diff = grid_results.grid(indices(i));
 
-    // Get indices of those with lower stress
-    arma::uvec indices = arma::find( grid_results.grid < stress_lim );
+    // Get the coords of the improved grid position
+    arma::uvec sub = arma::ind2sub( arma::size(grid_results.grid), indices(i) );
+    hemi_ag_improved_coords(0) = grid_results.xcoords( sub(0) );
+    hemi_ag_improved_coords(1) = grid_results.ycoords( sub(1) );
+    if(dim == 3){
+      hemi_ag_improved_coords(2) = grid_results.zcoords( sub(2) );
+    }
 
-    // For those with lower stress see if they move back to the original position
-    // on relaxing the map
-    for(arma::uword i=0; i<indices.n_elem; i++){
+    // Move the antigen to the test position
+    ag_coords.row(ag) = hemi_ag_improved_coords;
+
+    // Relax the coordinates
+    ac_relax_coords(
+      tabledists,
+      titertypes,
+      ag_coords,
+      sr_coords,
+      options,
+      fixed_antigens,
+      fixed_sera
+    );
 
-      // Get the stress diff
-      double stress_diff = grid_results.grid(indices(i));
+    // Get the coords of the relaxed position
+    // and replace the antigen to the original position
+    hemi_ag_relaxed_coords = ag_coords.row(ag);
+    ag_coords.row(ag) = hemi_ag_orig_coords;
+
+    // Check if the hemisphering point is in a new position
+    bool equals_original_coords = arma::approx_equal(
+      hemi_ag_orig_coords,
+      hemi_ag_relaxed_coords,
+      "absdiff",
+      0.001
+    );
 
-      // Get the coords of the improved grid position
-      arma::uvec sub = arma::ind2sub( arma::size(grid_results.grid), indices(i) );
-      hemi_ag_improved_coords(0) = grid_results.xcoords( sub(0) );
-      hemi_ag_improved_coords(1) = grid_results.ycoords( sub(1) );
-      if(dim == 3){
-        hemi_ag_improved_coords(3) = grid_results.zcoords( sub(2) );
+    bool equals_previous_diagnosis = false;
+    for (auto &diagnosis : hemi_diagnoses) {
+      if (
+        arma::approx_equal(
+          diagnosis.coords,
+          hemi_ag_relaxed_coords.as_col(),
+          "absdiff",
+          0.001
+        )
+      ) {
+        equals_previous_diagnosis = true;
+        break;
       }
+    }
 
-      // Move the antigen to the test position
-      ag_coords.row(ag) = hemi_ag_improved_coords;
+    // Add the record
+    if (!equals_original_coords && !equals_previous_diagnosis) {
 
-      // Set other points to be fixed
-      fixed_antigens = arma::regspace<arma::uvec>( 0, num_ags - 1);
-      fixed_sera = arma::regspace<arma::uvec>( 0, num_sr - 1);
-      fixed_antigens.shed_row( ag );
+      // Set the diagnosis
+      std::string diagnosis;
+      if (stress_diff < -stress_lim) diagnosis = "trapped";
+      else if ( stress_diff < 0)     diagnosis = "hemisphering-trapped";
+      else                           diagnosis = "hemisphering";
 
-      // Relax the coordinates
-      ac_relax_coords(
-        tabledists,
-        titertypes,
-        ag_coords,
-        sr_coords,
-        options,
-        fixed_antigens,
-        fixed_sera
+      // Append a record of the coordinates
+      hemi_diagnoses.push_back(
+        HemiDiagnosis { diagnosis, hemi_ag_relaxed_coords.as_col() }
       );
 
-      // Get the coords of the relaxed position
-      // and replace the antigen to the original position
-      hemi_ag_relaxed_coords = ag_coords.row(ag);
-      ag_coords.row(ag) = hemi_ag_orig_coords;
-
-      // Check if the hemisphering point is in a new position
-      bool equals_original_coords = arma::approx_equal(
-        hemi_ag_orig_coords,
-        hemi_ag_relaxed_coords,
-        "absdiff",
-        0.001
-      );
+    }
 
-      bool equals_previous_diagnosis = false;
-      for (auto &diagnosis : hemi_diagnoses) {
-        if (
-          arma::approx_equal(
-            diagnosis.coords,
-            hemi_ag_relaxed_coords.as_col(),
-            "absdiff",
-            0.001
-          )
-        ) {
-          equals_previous_diagnosis = true;
-          break;
-        }
-      }
+  }
 
-      // Add the record
-      if (!equals_original_coords && !equals_previous_diagnosis) {
+  return hemi_diagnoses;
 
-        // Set the diagnosis
-        std::string diagnosis;
-        if (stress_diff < -stress_lim) diagnosis = "trapped";
-        else if ( stress_diff < 0)     diagnosis = "hemisphering-trapped";
-        else                           diagnosis = "hemisphering";
+}
 
-        // Append a record of the coordinates
-        hemi_diagnoses.push_back(
-          HemiDiagnosis { diagnosis, hemi_ag_relaxed_coords.as_col() }
-        );
 
-      }
+// Diagnose hemisphering of each point in parallel, each thread works on a
+// copy of the coordinates and results are returned in point order
+std::vector<HemiData> ac_hemi_test_points(
+  const arma::mat &ag_coords,
+  const arma::mat &sr_coords,
+  const arma::mat &tabledists,
+  const arma::umat &titertypes,
+  double grid_spacing,
+  double stress_lim,
+  AcOptimizerOptions options
+){
+
+  // Set variables
+  int num_ags = ag_coords.n_rows;
+  arma::uword dim = ag_coords.n_cols;
 
+  // Check input
+  if(dim < 2 || dim > 3){
+    ac_error("Hemisphere testing is only supported for 2 or 3 dimensions");
+  }
+
+  // Check hemisphering antigens
+  std::vector< std::vector<HemiDiagnosis> > hemi_diagnoses(num_ags);
+
+  #pragma omp parallel num_threads(ac_num_threads(options.num_cores))
+  {
+
+    arma::mat thread_ag_coords = ag_coords;
+    arma::mat thread_sr_coords = sr_coords;
+
+    #pragma omp for schedule(dynamic)
+    for(int ag=0; ag<num_ags; ag++){
+      hemi_diagnoses[ag] = ac_hemi_test_point(
+        ag,
+        thread_ag_coords,
+        thread_sr_coords,
+        tabledists,
+        titertypes,
+        grid_spacing,
+        stress_lim,
+        options
+      );
     }
 
-    // Append the record of hemisphering coordinates
-    if(hemi_diagnoses.size() > 0){
+  }
+
+  // Append the record of hemisphering coordinates
+  std::vector<HemiData> output;
+  for(int ag=0; ag<num_ags; ag++){
+    if(hemi_diagnoses[ag].size() > 0){
       HemiData hdata;
-      hdata.diagnoses = hemi_diagnoses;
+      hdata.diagnoses = hemi_diagnoses[ag];
       hdata.index = ag;
       output.push_back( hdata );
     }
-
   }
 
   // Return the output
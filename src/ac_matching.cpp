@@ -1,39 +1,51 @@
 
 #include <RcppArmadillo.h>
+#include <unordered_map>
 #include "acmap_map.h"
 
+// Match points by their match ids, returning for each point in points1 the
+// index of the matching point in points2, or -1 if there is no match. Match
+// ids of points2 are indexed in a hash table on each call so matching runs in
+// linear rather than quadratic time.
 template <typename T>
 arma::ivec ac_match_points(
   T const& points1,
   T const& points2
 ){
 
+  // Index points2 by match id, marking ids that occur more than once
+  std::unordered_map<std::string, arma::sword> ids2;
+  ids2.reserve(points2.size());
+  for(arma::uword j=0; j<points2.size(); j++){
+    auto inserted = ids2.emplace(points2[j].get_match_id(), j);
+    if(!inserted.second) inserted.first->second = -2;
+  }
+
   arma::ivec matches(points1.size());
   matches.fill(-1);
 
   for(arma::uword i=0; i<points1.size(); i++){
-    for(arma::uword j=0; j<points2.size(); j++){
-
-      std::string id1 = points1[i].get_match_id();
-      std::string id2 = points2[j].get_match_id();
-
-      if(id1 == id2){
-        // Check we are replacing a -1 value
-        if(matches(i) == -1){
-          matches(i) = j;
-        }
-        // Otherwise throw an error
-        else {
-          Rcpp::stop("Multiple matches found for '"+id2+"'");
-        }
-      }
 
+    const std::string& id1 = points1[i].get_match_id();
+    auto found = ids2.find(id1);
+    if(found == ids2.end()) continue;
+
+    // Throw an error if the point matches more than one point
+    if(found->second == -2){
+      Rcpp::stop("Multiple matches found for '"+id1+"'");
     }
+    matches(i) = found->second;
+
   }
   return matches;
 
 }
 
+// The template is only declared in ac_matching.h, so instantiate it here for
+// the antigens and sera matched in ac_merge.cpp, procrustes.cpp and acmap_map.h
+template arma::ivec ac_match_points(std::vector<AcAntigen> const&, std::vector<AcAntigen> const&);
+template arma::ivec ac_match_points(std::vector<AcSerum> const&, std::vector<AcSerum> const&);
+
 // [[Rcpp::export]]
 arma::ivec ac_match_map_ags(
     AcMap const& map1,
@@ -1,10 +1,12 @@
 
 # include <RcppArmadillo.h>
+# include <unordered_set>
 # include "acmap_map.h"
 # include "acmap_titers.h"
 # include "ac_titers.h"
 # include "ac_matching.h"
 # include "ac_optimization.h"
+# include "utils_parallel.h"
 
 // For merging character titers
 AcTiter ac_merge_titers(
@@ -63,58 +65,137 @@ AcTiter ac_merge_titers(
 
 }
 
-// For merging titer layers
-// [[Rcpp::export]]
+// Merge the titers of a single cell from raw arrays of the titer types and
+// numeric titers in each layer, following the same rules as ac_merge_titers()
+// without allocating. Types must be titer types as stored in an AcTiterTable,
+// anything else gives *. The mean and standard deviation are computed
+// directly so may differ from ac_merge_titers() by floating point rounding.
+AcTiter ac_merge_raw_titers(
+    const unsigned char* types,
+    const double* numerics,
+    const arma::uword num_layers,
+    double* logtiters,
+    const double sd_lim
+){
+
+  // Return the titer if only one layer
+  if(num_layers == 1){
+    return AcTiter(numerics[0], types[0]);
+  }
+
+  // Count the titer types and find the min and max numeric titers
+  arma::uword num_types[4] = { 0, 0, 0, 0 };
+  double min_numeric = arma::datum::inf;
+  double max_numeric = -arma::datum::inf;
+  arma::uword num_logtiters = 0;
+
+  for(arma::uword i=0; i<num_layers; i++){
+    if(types[i] > 3) return AcTiter();
+    num_types[types[i]]++;
+    if(types[i] == 0) continue;
+    if(numerics[i] < min_numeric) min_numeric = numerics[i];
+    if(numerics[i] > max_numeric) max_numeric = numerics[i];
+    logtiters[num_logtiters] = AcTiter(numerics[i], types[i]).logTiter();
+    num_logtiters++;
+  }
+
+  // 1. If there are > and < titers, result is *
+  if(num_types[2] > 0 && num_types[3] > 0) return AcTiter();
+
+  // 2. If there are just *, result is *
+  if(num_logtiters == 0) return AcTiter();
+
+  // 3. If there are just lessthan titers, result is min of them, keeping lessthan
+  if(num_types[2] == num_logtiters) return AcTiter(min_numeric, 2);
+
+  // 4. If there are just morethan titers, result is max of them, keeping morethan
+  if(num_types[3] == num_logtiters) return AcTiter(max_numeric, 3);
+
+  // 5. Take the mean of the log titers
+  double sum = 0;
+  for(arma::uword i=0; i<num_logtiters; i++){
+    sum += logtiters[i];
+  }
+  double mean = sum / num_logtiters;
+
+  // 6. Compute SD, if SD > sd_lim, result is *
+  if(sd_lim == sd_lim && num_logtiters >= 2){
+    double ssq = 0;
+    for(arma::uword i=0; i<num_logtiters; i++){
+      double diff = logtiters[i] - mean;
+      ssq += diff*diff;
+    }
+    double var = ssq / (num_logtiters - 1);
+    if(std::sqrt(var) > sd_lim) return AcTiter();
+  }
+
+  // 7. Otherwise return the mean
+  return AcTiter(
+    std::pow(2.0, mean)*10,
+    1
+  );
+
+}
+
+// For merging titer layers, sera are merged in parallel with each thread
+// gathering the titers of a serum from every layer into its own scratch arrays
 AcTiterTable ac_merge_titer_layers(
-    const std::vector<AcTiterTable>& titer_layers
+    const std::vector<AcTiterTable>& titer_layers,
+    const int &num_cores
 ){
 
-  int num_ags = titer_layers[0].nags();
-  int num_sr  = titer_layers[0].nsr();
-  int num_layers = titer_layers.size();
+  if(titer_layers.empty()) Rcpp::stop("There are no titer table layers to merge");
+
+  const arma::uword num_ags = titer_layers[0].nags();
+  const arma::uword num_sr  = titer_layers[0].nsr();
+  const arma::uword num_layers = titer_layers.size();
 
   AcTiterTable merged_table = AcTiterTable(
     num_ags,
     num_sr
   );
 
-  std::vector<AcTiter> titers(num_layers, AcTiter());
+  #pragma omp parallel num_threads(ac_num_threads(num_cores))
+  {
 
-  for(int ag=0; ag<num_ags; ag++){
-    for(int sr=0; sr<num_sr; sr++){
-      for(int i=0; i<num_layers; i++){
-        titers[i] = titer_layers[i].get_titer(ag,sr);
-      }
-      merged_table.set_titer(
-        ag, sr,
-        ac_merge_titers(
-          titers
-        )
-      );
-    }
-  }
+    // Titers are gathered by antigen, then layer
+    std::vector<double> numerics(num_ags*num_layers);
+    std::vector<unsigned char> types(num_ags*num_layers);
+    std::vector<double> sr_numerics(num_ags);
+    std::vector<unsigned char> sr_types(num_ags);
+    std::vector<double> logtiters(num_layers);
 
-  return merged_table;
-
-}
+    #pragma omp for schedule(dynamic)
+    for(arma::uword sr=0; sr<num_sr; sr++){
 
+      for(arma::uword layer=0; layer<num_layers; layer++){
+        titer_layers[layer].get_serum_titers(sr, &sr_numerics[0], &sr_types[0]);
+        for(arma::uword ag=0; ag<num_ags; ag++){
+          numerics[ag*num_layers + layer] = sr_numerics[ag];
+          types[ag*num_layers + layer] = sr_types[ag];
+        }
+      }
 
-// Check if point already in points
-template <typename T>
-bool pt_in_points(
-    const T& pt,
-    const std::vector<T>& pts
-){
+      for(arma::uword ag=0; ag<num_ags; ag++){
+        merged_table.set_titer_unchecked(
+          ag, sr,
+          ac_merge_raw_titers(
+            &types[ag*num_layers],
+            &numerics[ag*num_layers],
+            num_layers,
+            &logtiters[0],
+            1.0
+          )
+        );
+      }
 
-  for(auto &ptspt : pts){
-    if(ptspt.get_match_id() == pt.get_match_id()){
-      return true;
     }
+
   }
-  return false;
 
-}
+  return merged_table;
 
+}
 
 // Construct another titer table based on a subset of indices
 AcTiterTable subset_titer_table(
@@ -257,17 +338,19 @@ AcMap ac_merge_tables(
   std::vector<AcSerum> merged_sera;
   std::vector<AcTiterTable> merged_layers;
 
-  // Add antigens and sera
+  // Add antigens and sera, keeping track of the match ids already added
+  std::unordered_set<std::string> merged_ag_ids;
+  std::unordered_set<std::string> merged_sr_ids;
   for(arma::uword i=0; i<maps.size(); i++){
 
     for(arma::uword ag=0; ag<maps[i].antigens.size(); ag++){
-      if(!pt_in_points(maps[i].antigens[ag], merged_antigens)){
+      if(merged_ag_ids.insert(maps[i].antigens[ag].get_match_id()).second){
         merged_antigens.push_back(maps[i].antigens[ag]);
       }
     }
 
     for(arma::uword sr=0; sr<maps[i].sera.size(); sr++){
-      if(!pt_in_points(maps[i].sera[sr], merged_sera)){
+      if(merged_sr_ids.insert(maps[i].sera[sr].get_match_id()).second){
         merged_sera.push_back(maps[i].sera[sr]);
       }
     }
@@ -290,6 +373,8 @@ AcMap ac_merge_tables(
           merged_map_sr_matches
         )
       );
+      // Layers of merged tables are mostly unmeasured so store them compactly
+      merged_layers.back().compact();
     }
 
   }
@@ -531,7 +616,7 @@ AcMap ac_merge_incremental_single(
   sort_optimizations_by_stress(optimizations);
 
   // Realign optimizations to the first one
-  align_optimizations(optimizations);
+  align_optimizations(optimizations, options.num_cores);
 
   // Set column bases
   for(auto &optimization : optimizations){
@@ -10,8 +10,10 @@ AcTiter ac_merge_titers(
     double sd_lim = 1.0
 );
 
+// [[Rcpp::export]]
 AcTiterTable ac_merge_titer_layers(
-    const std::vector<AcTiterTable>& titer_layers
+    const std::vector<AcTiterTable>& titer_layers,
+    const int &num_cores = 1
 );
 
 #endif
@@ -9,13 +9,15 @@
 #include "acmap_optimization.h"
 #include "ac_stress_blobs.h"
 #include "ac_optimizer_options.h"
+#include "utils_parallel.h"
 
 // Check for trapped antigens
 arma::mat check_ag_trapped_points(
     const AcOptimization &optimization,
     const arma::mat &tabledists,
     const arma::umat &titertypes,
-    const double &grid_spacing
+    const double &grid_spacing,
+    const int &num_threads
 ){
 
   // Variables
@@ -28,7 +30,7 @@ arma::mat check_ag_trapped_points(
   trapped_ag_improved_coords.fill(arma::datum::nan);
 
   // Check trapped antigens
-  #pragma omp parallel for schedule(dynamic)
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
   for(int ag=0; ag<num_ags; ag++){
 
     // Do a grid search
@@ -62,7 +64,8 @@ arma::mat check_sr_trapped_points(
     const AcOptimization &optimization,
     const arma::mat &tabledists,
     const arma::umat &titertypes,
-    const double &grid_spacing
+    const double &grid_spacing,
+    const int &num_threads
 ){
 
   // Variables
@@ -75,7 +78,7 @@ arma::mat check_sr_trapped_points(
   trapped_sr_improved_coords.fill(arma::datum::nan);
 
   // Check trapped sera
-  #pragma omp parallel for schedule(dynamic)
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
   for(int sr=0; sr<num_sr; sr++){
 
     // Do a grid search
@@ -117,7 +120,8 @@ AcOptimization ac_move_trapped_points(
 
 
   // Check antigen and sera trapped points recursively
-  if(options.report_progress) REprintf("Checking for trapped points recursively:");
+  int num_threads = ac_num_threads(options.num_cores);
+  if(options.report_progress) REprintf("Checking for trapped points recursively using %d threads:", num_threads);
 
   int num_iterations = 0;
   while(num_iterations < max_iterations){
@@ -127,8 +131,8 @@ AcOptimization ac_move_trapped_points(
     arma::mat sr_coords = optimization.get_sr_base_coords();
 
     // Check for any improved coordinates
-    arma::mat ag_trapped_improved_coords = check_ag_trapped_points(optimization, tabledists, titertypes, grid_spacing);
-    arma::mat sr_trapped_improved_coords = check_sr_trapped_points(optimization, tabledists, titertypes, grid_spacing);
+    arma::mat ag_trapped_improved_coords = check_ag_trapped_points(optimization, tabledists, titertypes, grid_spacing, num_threads);
+    arma::mat sr_trapped_improved_coords = check_sr_trapped_points(optimization, tabledists, titertypes, grid_spacing, num_threads);
 
     // Get any improved indices
     arma::uvec ag_trapped_coord_indices = arma::find_finite(ag_trapped_improved_coords);
@@ -1,13 +1,75 @@
 
+#include <RcppArmadillo.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+// [[Rcpp::plugins(openmp)]]
+
 #include "acmap_map.h"
 #include "acmap_titers.h"
 #include "ac_optim_map_stress.h"
 #include "ac_noisy_bootstrap.h"
 #include "ac_optimizer_options.h"
+#include "ac_optimization.h"
+#include "procrustes.h"
+#include "utils_parallel.h"
+#include "utils_progress.h"
+#include "utils_random.h"
 
+// Find the lowest stress coordinates from a set of optimizations of a noisy
+// table, the optimizations are run one after another and without progress
+// reporting so that this can be called from multiple threads. At least one
+// optimization must be run.
+arma::mat ac_noisy_bootstrap_coords(
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    const arma::uword &num_dims,
+    const int &num_optimizations,
+    const AcOptimizerOptions &options
+){
+
+  // Find the dimensions to relax through and box size for random coordinates
+  arma::uvec dim_set = ac_optimization_dim_set(num_dims, options);
+  double coord_boxsize = ac_optimization_boxsize(
+    tabledist_matrix,
+    titertype_matrix,
+    dim_set(0),
+    options
+  );
+
+  // Run the optimizations keeping only the lowest stress run
+  AcOptimizationHeap best_optimization(1);
+  for(int i=0; i<num_optimizations; i++){
+    best_optimization.offer(
+      i,
+      ac_runOptimization(
+        tabledist_matrix,
+        titertype_matrix,
+        dim_set,
+        coord_boxsize,
+        i,
+        options
+      )
+    );
+  }
+
+  AcOptimization optimization = std::move(best_optimization.take()[0]);
+  return arma::join_cols(
+    optimization.agCoords(),
+    optimization.srCoords()
+  );
+
+}
+
+
+// Run all noisy bootstrap repeats in parallel, aligning the resulting
+// coordinates of each repeat to the target coordinates
 // [[Rcpp::export]]
-NoisyBootstrapOutput ac_noisy_bootstrap_map(
+NoisyBootstrapRepeats ac_noisy_bootstrap_repeats(
     AcTiterTable titer_table,
+    arma::mat target_coords,
+    int num_repeats,
     double ag_noise_sd,
     double titer_noise_sd,
     std::string minimum_column_basis,
@@ -18,55 +80,106 @@ NoisyBootstrapOutput ac_noisy_bootstrap_map(
 ){
 
   // Declare variables
-  arma::vec colbases;
-
-  // Add noise to the titer table
   int num_ags = titer_table.nags();
   int num_sr = titer_table.nsr();
+  int num_threads = ac_num_threads(options.num_cores);
 
-  // First a matrix of shared antigen noise
-  arma::vec ag_noise = arma::randn<arma::vec>(num_ags)*ag_noise_sd;
-  arma::mat ag_noise_matrix(num_ags, num_sr, arma::fill::zeros);
-  ag_noise_matrix.each_col() += ag_noise;
-  titer_table.add_log_titers(ag_noise_matrix);
-
-  // Then a full matrix of titer noise
-  arma::mat titer_noise = arma::randn<arma::mat>(num_ags, num_sr)*titer_noise_sd;
-  titer_table.add_log_titers(titer_noise);
+  // Log titers and titer types are shared by all repeats
+  arma::mat log_titers = titer_table.log_titers();
+  arma::umat titer_types = titer_table.get_titer_types();
 
-  // Get column bases after setting noise if not setting from full table
-  colbases = titer_table.colbases(
+  // Check the settings up front since errors cannot be raised from within the
+  // parallel region
+  if(num_repeats < 0) Rcpp::stop("Number of bootstrap repeats must not be negative");
+  if(num_optimizations < 1) Rcpp::stop("At least one optimization must be run per bootstrap repeat");
+  titer_table.colbases(
     minimum_column_basis,
     fixed_column_bases
   );
 
-  // Run the optimization
-  std::vector<AcOptimization> optimizations;
-  optimizations = ac_runOptimizations(
-    titer_table,
-    colbases,
-    num_dimensions,
-    num_optimizations,
-    options
-  );
+  // Repeats are run in parallel so optimizations within each run on one thread
+  AcOptimizerOptions repeat_options = options;
+  repeat_options.num_cores = 1;
+  repeat_options.report_progress = false;
+  repeat_options.prune_runs = false;
 
-  // Sort by stress and keep lowest stress coords
-  sort_optimizations_by_stress(optimizations);
-  arma::mat coords = arma::join_cols(
-    optimizations[0].agCoords(),
-    optimizations[0].srCoords()
-  );
+  // Centre the target coordinates once for aligning every repeat
+  ProcrustesTarget target = ac_procrustes_target(target_coords, true, false);
 
-  // Setup for output
-  struct NoisyBootstrapOutput results{
-    ag_noise,
-    coords
+  // Preallocate the results
+  NoisyBootstrapRepeats results{
+    arma::mat(num_ags, num_repeats, arma::fill::zeros),
+    arma::cube(num_ags + num_sr, num_dimensions, num_repeats, arma::fill::zeros)
   };
 
-  // Return results
-  return results;
+  // Set progress bar
+  if(options.report_progress) REprintf("Performing %d bootstrap repeats using %d threads\n", num_repeats, num_threads);
+  AcProgressBar pb(options.progress_bar_length, options.report_progress);
+  Progress p(num_repeats, true, pb);
 
-}
+  // Run the bootstrap repeats
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+  for(int i=0; i<num_repeats; i++){
+
+    if( !p.check_abort() ){
+
+      p.increment();
+      AcRNG rng(options.seed, i);
+
+      // First a vector of shared antigen noise
+      arma::vec ag_noise(num_ags);
+      ag_noise.imbue( [&]() { return rng.rnorm()*ag_noise_sd; } );
+
+      // Then a full matrix of titer noise
+      arma::mat noisy_log_titers(num_ags, num_sr);
+      noisy_log_titers.imbue( [&]() { return rng.rnorm()*titer_noise_sd; } );
+      noisy_log_titers.each_col() += ag_noise;
+      noisy_log_titers += log_titers;
+
+      // Get column bases and table distances after setting noise
+      arma::vec colbases = titer_table.colbases_from_log_titers(
+        noisy_log_titers,
+        minimum_column_basis,
+        fixed_column_bases
+      );
 
+      arma::mat tabledist_matrix = titer_table.table_distances_from_log_titers(
+        noisy_log_titers,
+        colbases
+      );
 
+      // Run the optimizations from a seed of their own and keep the lowest
+      // stress coords
+      AcOptimizerOptions run_options = repeat_options;
+      run_options.seed = static_cast<unsigned int>(rng.next());
+      arma::mat coords = ac_noisy_bootstrap_coords(
+        tabledist_matrix,
+        titer_types,
+        num_dimensions,
+        num_optimizations,
+        run_options
+      );
 
+      // Align to the target coordinates and store
+      results.ag_noise.col(i) = ag_noise;
+      results.coords.slice(i) = ac_apply_procrustes(
+        coords,
+        ac_procrustes_to_target(coords, target)
+      );
+
+    }
+
+  }
+
+  // Report finished
+  if( p.is_aborted() ){
+    pb.complete("Bootstrap repeats interrupted", false);
+    Rcpp::stop("Bootstrap repeats interrupted");
+  } else {
+    pb.complete("Bootstrap repeats complete");
+  }
+
+  // Return results
+  return results;
+
+}
@@ -6,21 +6,19 @@
 #ifndef Racmacs__ac_noisy_bootstrap__h
 #define Racmacs__ac_noisy_bootstrap__h
 
+// Results of a bootstrap repeat as stored with an optimization
 struct NoisyBootstrapOutput
 {
   arma::vec ag_noise;
   arma::mat coords;
 };
 
-NoisyBootstrapOutput ac_noisy_bootstrap_map(
-    AcTiterTable titer_table,
-    double ag_noise_sd,
-    double titer_noise_sd,
-    std::string minimum_column_basis,
-    bool column_bases_from_full_table,
-    int num_optimizations,
-    int num_dimensions,
-    AcOptimizerOptions options
-);
+// Results of all bootstrap repeats, with the antigen noise of each repeat
+// as a column and the aligned coordinates of each repeat as a slice
+struct NoisyBootstrapRepeats
+{
+  arma::mat ag_noise;
+  arma::cube coords;
+};
 
 #endif
@@ -11,6 +11,8 @@
 
 #include "utils.h"
 #include "utils_progress.h"
+#include "utils_parallel.h"
+#include "utils_random.h"
 #include "ac_stress.h"
 #include "ac_optim_map_stress.h"
 #include "ac_optimization.h"
@@ -21,6 +23,10 @@
 
 
 // SETUP THE MAP OPTIMIZER CLASS
+// The template parameter D fixes the number of map dimensions at compile time
+// so that loops over coordinates can be unrolled, D = 0 is the generic version
+// where the number of dimensions is only known at runtime.
+template <arma::uword D>
 class MapOptimizer {
 
   public:
@@ -28,9 +34,6 @@ class MapOptimizer {
     // ATTRIBUTES
     arma::mat ag_coords;
     arma::mat sr_coords;
-    arma::mat tabledist_matrix;
-    arma::umat titertype_matrix;
-    arma::mat mapdist_matrix;
     arma::uword num_dims;
     arma::uword num_ags;
     arma::uword num_sr;
@@ -41,6 +44,31 @@ class MapOptimizer {
     double gradient;
     double stress;
 
+    // Measured titers are held as a flat list of antigen-sera pairs so that
+    // evaluation scales with the number of titrations rather than table size.
+    // The list is partitioned by type, measurable titers come first followed
+    // by less than titers from titer_lessthan_start onwards.
+    arma::uword num_titers;
+    arma::uword titer_lessthan_start;
+    arma::uvec titer_ags;
+    arma::uvec titer_srs;
+    arma::vec titer_tabledists;
+    arma::uvec titer_types;
+    arma::vec titer_mapdists;
+    arma::vec titer_ibases;
+
+    // Titers between two fixed points are left out of the list, since their
+    // distances cannot change their stress is calculated once and added on
+    double fixed_stress;
+
+    // Number of titers evaluated in each block of the batched stress kernels
+    static const arma::uword block_size = 256;
+
+    // Coordinate differences of the titers in a block, kept from the distance
+    // calculation for the gradient, only used when D = 0 since for fixed
+    // dimensions a fixed size array is used instead
+    std::vector<double> block_diffs;
+
     // CONSTRUCTOR FUNCTION
     // Constructor without fixed points provided
     MapOptimizer(
@@ -52,8 +80,6 @@ class MapOptimizer {
     )
       :ag_coords(ag_start_coords),
        sr_coords(sr_start_coords),
-       tabledist_matrix(tabledist),
-       titertype_matrix(titertype),
        num_dims(dims),
        num_ags(tabledist.n_rows),
        num_sr(tabledist.n_cols)
@@ -63,14 +89,15 @@ class MapOptimizer {
       moveable_ags = arma::regspace<arma::uvec>(0, num_ags - 1);
       moveable_sr = arma::regspace<arma::uvec>(0, num_sr - 1);
 
-      // Setup map dist matrices
-      mapdist_matrix = arma::mat(num_ags, num_sr, arma::fill::zeros);
+      // Setup the list of measured titers
+      setup_titer_list(tabledist, titertype);
 
       // Setup the gradient vectors
       ag_gradients.zeros(num_ags, num_dims);
       sr_gradients.zeros(num_sr, num_dims);
+      block_diffs.resize(D > 0 ? 0 : block_size*num_dims);
 
-      // Update the map distance matrix according to coordinates
+      // Update the map distances according to coordinates
       update_map_dist_matrix();
 
     }
@@ -87,8 +114,6 @@ class MapOptimizer {
     )
       :ag_coords(ag_start_coords),
        sr_coords(sr_start_coords),
-       tabledist_matrix(tabledist),
-       titertype_matrix(titertype),
        num_dims(dims),
        num_ags(tabledist.n_rows),
        num_sr(tabledist.n_cols),
@@ -96,18 +121,112 @@ class MapOptimizer {
        moveable_sr(moveable_sr)
       {
 
-      // Setup map dist matrices
-      mapdist_matrix = arma::mat(num_ags, num_sr, arma::fill::zeros);
+      // Setup the list of measured titers
+      setup_titer_list(tabledist, titertype);
 
       // Setup the gradient vectors
       ag_gradients.zeros(num_ags, num_dims);
       sr_gradients.zeros(num_sr, num_dims);
+      block_diffs.resize(D > 0 ? 0 : block_size*num_dims);
 
-      // Update the map distance matrix according to coordinates
+      // Update the map distances according to coordinates
       update_map_dist_matrix();
 
     }
 
+    // NUMBER OF DIMENSIONS
+    // A compile time constant whenever D is set
+    inline arma::uword dims() const {
+      return D > 0 ? D : num_dims;
+    }
+
+    // SETUP THE MEASURED TITER LIST
+    // Titers are partitioned by type so that the stress of each type can be
+    // evaluated in batches without branching. More than titers are left out
+    // since they never contribute to the stress or gradient. Only titers
+    // involving a moveable point are listed, so when most points are fixed
+    // each evaluation scales with the titers of the moveable points.
+    void setup_titer_list(
+      const arma::mat &tabledist,
+      const arma::umat &titertype
+    ){
+
+      // Flag the moveable points
+      std::vector<bool> ag_moveable(num_ags, false);
+      std::vector<bool> sr_moveable(num_sr, false);
+      for(auto &ag : moveable_ags) ag_moveable[ag] = true;
+      for(auto &sr : moveable_sr) sr_moveable[sr] = true;
+
+      // Count the titers of each type to be listed
+      arma::uword num_listed[3] = { 0, 0, 0 };
+      for(arma::uword sr = 0; sr < num_sr; ++sr) {
+        for(arma::uword ag = 0; ag < num_ags; ++ag) {
+          arma::uword type = titertype.at(ag,sr);
+          if((type == 1 || type == 2) && (ag_moveable[ag] || sr_moveable[sr])){
+            num_listed[type]++;
+          }
+        }
+      }
+
+      titer_lessthan_start = num_listed[1];
+      num_titers = num_listed[1] + num_listed[2];
+      titer_ags.set_size(num_titers);
+      titer_srs.set_size(num_titers);
+      titer_tabledists.set_size(num_titers);
+      titer_types.set_size(num_titers);
+      titer_mapdists.zeros(num_titers);
+      titer_ibases.zeros(num_titers);
+
+      // Table and map distances of titers between fixed points by type
+      std::vector<double> fixed_tabledists[3];
+      std::vector<double> fixed_mapdists[3];
+
+      arma::uword n = 0;
+      for(arma::uword type = 1; type <= 2; ++type) {
+        for(arma::uword sr = 0; sr < num_sr; ++sr) {
+          for(arma::uword ag = 0; ag < num_ags; ++ag) {
+
+            // Skip titers of other types
+            if(titertype.at(ag,sr) != type){
+              continue;
+            }
+
+            // Set aside titers between fixed points
+            if(!ag_moveable[ag] && !sr_moveable[sr]){
+              double dist = 0;
+              for(arma::uword i = 0; i < dims(); ++i) {
+                double diff = ag_coords.at(ag,i) - sr_coords.at(sr,i);
+                dist += diff*diff;
+              }
+              fixed_tabledists[type].push_back(tabledist.at(ag,sr));
+              fixed_mapdists[type].push_back(sqrt(dist));
+              continue;
+            }
+
+            titer_ags(n) = ag;
+            titer_srs(n) = sr;
+            titer_tabledists(n) = tabledist.at(ag,sr);
+            titer_types(n) = type;
+            n++;
+
+          }
+        }
+      }
+
+      // Sum the stress of titers between fixed points
+      fixed_stress = ac_batchStress_measurable(
+        fixed_mapdists[1].data(),
+        fixed_tabledists[1].data(),
+        fixed_mapdists[1].size()
+      );
+      fixed_stress += ac_batchStress_lessthan(
+        fixed_mapdists[2].data(),
+        fixed_tabledists[2].data(),
+        fixed_mapdists[2].size()
+      );
+
+    }
+
     // EVALUATE OBJECTIVE FUNCTION
     // This is needed for optimization methods that don't evaluate the gradient
     double Evaluate(
@@ -126,7 +245,9 @@ class MapOptimizer {
     }
 
     // EVALUATE OBJECTIVE FUNCTION AND UPDATE GRADIENT
-    // This is needed for optimization methods that do evaluate the gradient
+    // This is needed for optimization methods that do evaluate the gradient,
+    // distances, stress and gradients are all calculated in a single pass
+    // over the measured titers
     double EvaluateWithGradient(
         const arma::mat &pars,
         arma::mat &grad
@@ -135,80 +256,94 @@ class MapOptimizer {
       // Update coords from parameters
       update_map_coords(pars);
 
-      // Update the gradients and distance matrix according to the new coords
-      update_map_dist_matrix();
-      update_gradients();
+      // Setup to update gradients and stress
+      ag_gradients.zeros();
+      sr_gradients.zeros();
+      stress = fixed_stress;
 
-      // Apply the gradients of moveable points to grad
-      grad = arma::join_cols(
-        ag_gradients.rows( moveable_ags ),
-        sr_gradients.rows( moveable_sr )
-      );
+      // Coordinate differences for the current block
+      double fixed_diffs[D > 0 ? D*block_size : 1];
+      double *diffs = D > 0 ? fixed_diffs : block_diffs.data();
 
-      // Calculate and return the stress
-      return calculate_stress();
+      // Work through the titers in blocks small enough to stay in cache
+      for(arma::uword start = 0; start < num_titers; start += block_size) {
 
-    }
+        arma::uword end = std::min(start + block_size, num_titers);
 
-    // CALCULATING STRESS GRADIENTS
-    void update_gradients(){
+        // Calculate the euclidean distances
+        for(arma::uword n = start; n < end; ++n) {
 
-      // Setup to update gradients
-      ag_gradients.zeros();
-      sr_gradients.zeros();
+          arma::uword ag = titer_ags(n);
+          arma::uword sr = titer_srs(n);
+          double *titer_diffs = diffs + (n - start)*dims();
 
-      // Now we cycle through each antigen and sera and calculate the gradient
-      for(arma::uword sr = 0; sr < num_sr; ++sr) {
-        for(arma::uword ag = 0; ag < num_ags; ++ag) {
-
-          // Skip unmeasured titers
-          if(titertype_matrix.at(ag,sr) == 0){
-            continue;
+          double dist = 0;
+          for(arma::uword i = 0; i < dims(); ++i) {
+            titer_diffs[i] = ag_coords.at(ag,i) - sr_coords.at(sr,i);
+            dist += titer_diffs[i]*titer_diffs[i];
           }
+          titer_mapdists(n) = sqrt(dist);
 
-          // Calculate inc_base
-          double ibase = inc_base(
-            mapdist_matrix.at(ag,sr),
-            tabledist_matrix.at(ag,sr),
-            titertype_matrix.at(ag,sr)
-          );
+        }
 
-          // Now calculate the gradient for each coordinate
-          for(arma::uword i = 0; i < num_dims; ++i) {
-            gradient = ibase*(ag_coords.at(ag,i) - sr_coords.at(sr,i));
+        // Calculate the stress and inc_base for measurable then less than titers
+        arma::uword split = std::min(std::max(start, titer_lessthan_start), end);
+        stress += ac_batchStress_inc_base_measurable(
+          titer_mapdists.memptr() + start,
+          titer_tabledists.memptr() + start,
+          titer_ibases.memptr() + start,
+          split - start
+        );
+        stress += ac_batchStress_inc_base_lessthan(
+          titer_mapdists.memptr() + split,
+          titer_tabledists.memptr() + split,
+          titer_ibases.memptr() + split,
+          end - split
+        );
+
+        // Now calculate the gradient for each coordinate
+        for(arma::uword n = start; n < end; ++n) {
+
+          arma::uword ag = titer_ags(n);
+          arma::uword sr = titer_srs(n);
+          const double *titer_diffs = diffs + (n - start)*dims();
+
+          for(arma::uword i = 0; i < dims(); ++i) {
+            gradient = titer_ibases(n)*titer_diffs[i];
             ag_gradients.at(ag,i) -= gradient;
             sr_gradients.at(sr,i) += gradient;
           }
 
         }
+
       }
 
+      // Apply the gradients of moveable points to grad
+      grad = arma::join_cols(
+        ag_gradients.rows( moveable_ags ),
+        sr_gradients.rows( moveable_sr )
+      );
+
+      // Return the stress
+      return stress;
+
     }
 
     // CALCULATING MAP STRESS
     double calculate_stress(){
 
-      // Set the start stress
-      stress = 0;
-
-      // Now we cycle through and sum up the stresses
-      for(arma::uword sr = 0; sr < num_sr; ++sr) {
-        for(arma::uword ag = 0; ag < num_ags; ++ag) {
-
-          // Skip unmeasured titers
-          if(titertype_matrix.at(ag,sr) == 0){
-            continue;
-          }
-
-          // Now calculate the stress
-          stress += ac_ptStress(
-            mapdist_matrix.at(ag,sr),
-            tabledist_matrix.at(ag,sr),
-            titertype_matrix.at(ag,sr)
-          );
-
-        }
-      }
+      // Sum up the stresses of measurable and then less than titers
+      stress = fixed_stress;
+      stress += ac_batchStress_measurable(
+        titer_mapdists.memptr(),
+        titer_tabledists.memptr(),
+        titer_lessthan_start
+      );
+      stress += ac_batchStress_lessthan(
+        titer_mapdists.memptr() + titer_lessthan_start,
+        titer_tabledists.memptr() + titer_lessthan_start,
+        num_titers - titer_lessthan_start
+      );
 
       // Return the map stress
       return stress;
@@ -220,13 +355,13 @@ class MapOptimizer {
       const arma::mat &pars
     ){
 
-      for(arma::uword j = 0; j < num_dims; ++j) {
+      for(arma::uword j = 0; j < dims(); ++j) {
         for(arma::uword i = 0; i < moveable_ags.n_elem; ++i) {
           ag_coords.at(moveable_ags(i),j) = pars.at(i, j);
         }
       }
 
-      for(arma::uword j = 0; j < num_dims; ++j) {
+      for(arma::uword j = 0; j < dims(); ++j) {
         for(arma::uword i = 0; i < moveable_sr.n_elem; ++i) {
           sr_coords.at(moveable_sr(i),j) = pars.at(i + moveable_ags.n_elem, j);
         }
@@ -234,21 +369,23 @@ class MapOptimizer {
 
     }
 
-    // UPDATE THE MAP DISTANCE MATRIX
+    // UPDATE THE MAP DISTANCES
     void update_map_dist_matrix(){
 
-      for (arma::uword sr = 0; sr < num_sr; sr++) {
-        for (arma::uword ag = 0; ag < num_ags; ag++) {
+      // Only calculate distances where ag and sr were titrated
+      for(arma::uword n = 0; n < num_titers; ++n) {
 
-          // Only calculate distances where ag and sr were titrated
-          if(titertype_matrix.at(ag,sr) == 0) continue;
-
-          // Calculate the euclidean distance
-          mapdist_matrix.at(ag,sr) = sqrt(arma::accu(arma::square(
-            ag_coords.row(ag) - sr_coords.row(sr)
-          )));
+        arma::uword ag = titer_ags(n);
+        arma::uword sr = titer_srs(n);
 
+        // Calculate the euclidean distance
+        double dist = 0;
+        for(arma::uword i = 0; i < dims(); ++i) {
+          double diff = ag_coords.at(ag,i) - sr_coords.at(sr,i);
+          dist += diff*diff;
         }
+        titer_mapdists(n) = sqrt(dist);
+
       }
 
     }
@@ -268,7 +405,7 @@ double ac_coords_stress(
   int num_dims = ag_coords.n_cols;
 
   // Create the map object for the map optimizer
-  MapOptimizer map(
+  MapOptimizer<0> map(
       ag_coords,
       sr_coords,
       tabledist_matrix,
@@ -282,31 +419,72 @@ double ac_coords_stress(
 }
 
 
-// [[Rcpp::export]]
-double ac_relax_coords(
+// Callback to abandon an optimization run once its stress is clearly worse
+// than the best run finished so far, checked every prune_interval iterations
+class AcPruneCallback {
+
+  public:
+
+    const double &stress;
+    AcOptimizerRace &race;
+    const AcOptimizerOptions &options;
+    int iteration = 0;
+    bool pruned = false;
+
+    AcPruneCallback(
+      const double &stress,
+      AcOptimizerRace &race,
+      const AcOptimizerOptions &options
+    ):
+      stress(stress),
+      race(race),
+      options(options){}
+
+    template<typename OptimizerType, typename FunctionType, typename MatType>
+    bool StepTaken(
+        OptimizerType &optimizer,
+        FunctionType &function,
+        MatType &coordinates
+    ){
+
+      iteration++;
+      if(options.prune_interval < 1 || iteration % options.prune_interval != 0){
+        return false;
+      }
+
+      // Terminate the optimization if stress is too high, never pruning
+      // before any run has finished
+      double best_stress = race.get_best_stress();
+      if(!std::isfinite(best_stress)) return false;
+      pruned = stress > best_stress*options.prune_threshold;
+      return pruned;
+
+    }
+
+};
+
+
+// Relax coordinates with a map optimizer for a given number of dimensions
+template <arma::uword D>
+double relax_map_coords(
     const arma::mat &tabledist_matrix,
     const arma::umat &titertype_matrix,
     arma::mat &ag_coords,
     arma::mat &sr_coords,
     const AcOptimizerOptions &options,
-    const arma::uvec &fixed_antigens,
-    const arma::uvec &fixed_sera
+    const arma::uvec &moveable_antigens,
+    const arma::uvec &moveable_sera,
+    AcOptimizerRace *race,
+    bool *pruned
 ){
 
-  // Set variables
-  arma::uword num_dims = ag_coords.n_cols;
-  arma::uvec moveable_antigens = arma::regspace<arma::uvec>(0, ag_coords.n_rows - 1);
-  arma::uvec moveable_sera = arma::regspace<arma::uvec>(0, sr_coords.n_rows - 1);
-  moveable_antigens.shed_rows(fixed_antigens);
-  moveable_sera.shed_rows(fixed_sera);
-
   // Create the map object for the map optimizer
-  MapOptimizer map(
+  MapOptimizer<D> map(
     ag_coords,
     sr_coords,
     tabledist_matrix,
     titertype_matrix,
-    num_dims,
+    ag_coords.n_cols,
     moveable_antigens,
     moveable_sera
   );
@@ -320,7 +498,21 @@ double ac_relax_coords(
   // Perform the optimization
   ens::L_BFGS lbfgs;
   lbfgs.MaxIterations() = options.maxit;
-  lbfgs.Optimize(map, pars);
+
+  if(race){
+
+    // Race against other runs, recording the outcome
+    AcPruneCallback callback(map.stress, *race, options);
+    lbfgs.Optimize(map, pars, callback);
+    if(callback.pruned) race->record_pruned(callback.iteration);
+    else                race->record_stress(map.calculate_stress());
+    if(pruned) *pruned = callback.pruned;
+
+  } else {
+
+    lbfgs.Optimize(map, pars);
+
+  }
 
   // Return the result
   ag_coords = map.ag_coords;
@@ -330,29 +522,90 @@ double ac_relax_coords(
 }
 
 
-// Generate a bunch of optimizations with randomized coordinates
-// this is a starting point for later relaxation
-std::vector<AcOptimization> ac_generateOptimizations(
-    const arma::vec &colbases,
+// [[Rcpp::export]]
+double ac_relax_coords(
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    arma::mat &ag_coords,
+    arma::mat &sr_coords,
+    const AcOptimizerOptions &options,
+    const arma::uvec &fixed_antigens,
+    const arma::uvec &fixed_sera
+){
+
+  return ac_relax_coords_with_race(
+    tabledist_matrix,
+    titertype_matrix,
+    ag_coords,
+    sr_coords,
+    options,
+    fixed_antigens,
+    fixed_sera,
+    nullptr,
+    nullptr
+  );
+
+}
+
+
+// Relax coordinates, racing against other runs unless race is nullptr, and
+// setting pruned to whether the run was abandoned unless it is nullptr
+double ac_relax_coords_with_race(
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    arma::mat &ag_coords,
+    arma::mat &sr_coords,
+    const AcOptimizerOptions &options,
+    const arma::uvec &fixed_antigens,
+    const arma::uvec &fixed_sera,
+    AcOptimizerRace *race,
+    bool *pruned
+){
+
+  // Set variables
+  arma::uword num_dims = ag_coords.n_cols;
+  arma::uvec moveable_antigens = arma::regspace<arma::uvec>(0, ag_coords.n_rows - 1);
+  arma::uvec moveable_sera = arma::regspace<arma::uvec>(0, sr_coords.n_rows - 1);
+  moveable_antigens.shed_rows(fixed_antigens);
+  moveable_sera.shed_rows(fixed_sera);
+
+  // Dispatch to an optimizer specialised for the number of dimensions, falling
+  // back to the generic version for higher dimensions
+  switch(num_dims) {
+  case 1:
+    return relax_map_coords<1>(tabledist_matrix, titertype_matrix, ag_coords, sr_coords, options, moveable_antigens, moveable_sera, race, pruned);
+  case 2:
+    return relax_map_coords<2>(tabledist_matrix, titertype_matrix, ag_coords, sr_coords, options, moveable_antigens, moveable_sera, race, pruned);
+  case 3:
+    return relax_map_coords<3>(tabledist_matrix, titertype_matrix, ag_coords, sr_coords, options, moveable_antigens, moveable_sera, race, pruned);
+  case 4:
+    return relax_map_coords<4>(tabledist_matrix, titertype_matrix, ag_coords, sr_coords, options, moveable_antigens, moveable_sera, race, pruned);
+  case 5:
+    return relax_map_coords<5>(tabledist_matrix, titertype_matrix, ag_coords, sr_coords, options, moveable_antigens, moveable_sera, race, pruned);
+  default:
+    return relax_map_coords<0>(tabledist_matrix, titertype_matrix, ag_coords, sr_coords, options, moveable_antigens, moveable_sera, race, pruned);
+  }
+
+}
+
+
+// Find the size of the box that starting coordinates are randomized within
+// from a rough optimization using max table dist as the box size
+double ac_optimization_boxsize(
     const arma::mat &tabledist_matrix,
     const arma::umat &titertype_matrix,
     const int &num_dims,
-    const int &num_optimizations,
     const AcOptimizerOptions &options
 ){
 
-  // Infer number of antigens and sera
-  int num_ags = tabledist_matrix.n_rows;
-  int num_sr = tabledist_matrix.n_cols;
-
-  // First run a rough optimization using max table dist as the box size
   AcOptimization initial_optim = AcOptimization(
     num_dims,
-    num_ags,
-    num_sr
+    tabledist_matrix.n_rows,
+    tabledist_matrix.n_cols
   );
 
-  initial_optim.randomizeCoords( tabledist_matrix.max() );
+  AcRNG initial_rng(options.seed, 0);
+  initial_optim.randomizeCoords( tabledist_matrix.max(), initial_rng );
   initial_optim.relax_from_raw_matrices(
     tabledist_matrix,
     titertype_matrix,
@@ -362,21 +615,49 @@ std::vector<AcOptimization> ac_generateOptimizations(
   // Set boxsize based on initial optimization result
   arma::mat distmat = initial_optim.distance_matrix();
   double coord_maxdist = distmat.max();
-  double coord_boxsize = coord_maxdist*2;
+  return coord_maxdist*2;
 
-  // Create starting optimizations with random coordinates
-  std::vector<AcOptimization> optimizations;
-  for(int i=0; i<num_optimizations; i++){
+}
 
-    AcOptimization optimization(
-        num_dims,
-        num_ags,
-        num_sr
-    );
 
-    optimization.randomizeCoords(coord_boxsize);
-    optimizations.push_back(optimization);
+// Generate a bunch of optimizations with randomized coordinates
+// this is a starting point for later relaxation, each optimization draws
+// from its own random number stream so results do not depend on threading
+std::vector<AcOptimization> ac_generateOptimizations(
+    const arma::vec &colbases,
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    const int &num_dims,
+    const int &num_optimizations,
+    const AcOptimizerOptions &options
+){
+
+  // Infer number of antigens and sera
+  int num_ags = tabledist_matrix.n_rows;
+  int num_sr = tabledist_matrix.n_cols;
 
+  // Find the box size for random coordinates
+  double coord_boxsize = ac_optimization_boxsize(
+    tabledist_matrix,
+    titertype_matrix,
+    num_dims,
+    options
+  );
+
+  // Create starting optimizations with random coordinates
+  std::vector<AcOptimization> optimizations(
+    num_optimizations,
+    AcOptimization(
+      num_dims,
+      num_ags,
+      num_sr
+    )
+  );
+
+  #pragma omp parallel for schedule(static) num_threads(ac_num_threads(options.num_cores))
+  for(int i=0; i<num_optimizations; i++){
+    AcRNG rng(options.seed, i + 1);
+    optimizations[i].randomizeCoords(coord_boxsize, rng);
   }
 
   // Return the randomized optimizations
@@ -385,7 +666,29 @@ std::vector<AcOptimization> ac_generateOptimizations(
 }
 
 
-// Relax the optimizations generated randomly
+// Report the runs abandoned when racing optimization runs
+void report_pruned_runs(
+    const AcOptimizerRace &race
+){
+
+  arma::vec pruned_iterations = arma::conv_to<arma::vec>::from(race.pruned_iterations);
+  if(pruned_iterations.n_elem == 0){
+    REprintf("No optimization runs pruned\n");
+  } else {
+    REprintf(
+      "%d optimization runs pruned after %g to %g iterations (median %g)\n",
+      (int)pruned_iterations.n_elem,
+      pruned_iterations.min(),
+      pruned_iterations.max(),
+      arma::median(pruned_iterations)
+    );
+  }
+
+}
+
+
+// Relax the optimizations generated randomly, runs abandoned when racing are
+// removed
 void ac_relaxOptimizations(
   std::vector<AcOptimization>& optimizations,
   const arma::vec &colbases,
@@ -396,28 +699,46 @@ void ac_relaxOptimizations(
 
   // Set variables
   int num_optimizations = optimizations.size();
+  int num_threads = ac_num_threads(options.num_cores);
 
   // Set progress bar
-  if(options.report_progress) REprintf("Performing %d optimizations\n", num_optimizations);
+  if(options.report_progress) REprintf("Performing %d optimizations using %d threads\n", num_optimizations, num_threads);
   AcProgressBar pb(options.progress_bar_length, options.report_progress);
   Progress p(num_optimizations, true, pb);
 
+  // Optionally race the runs against each other
+  AcOptimizerRace race;
+  AcOptimizerRace *race_ptr = options.prune_runs ? &race : nullptr;
+
   // Run and return optimization results
-  #pragma omp parallel for schedule(dynamic)
+  std::vector<char> pruned(num_optimizations, false);
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
   for(int i=0; i<num_optimizations; i++){
 
     // Run the optimization
     if( !p.check_abort() ){
       p.increment();
-      optimizations[i].relax_from_raw_matrices(
+      pruned[i] = optimizations[i].relax_from_raw_matrices(
           tabledist_matrix,
           titertype_matrix,
-          options
+          options,
+          arma::uvec(),
+          arma::uvec(),
+          race_ptr
       );
     }
 
   }
 
+  // Remove abandoned runs
+  arma::uword num_kept = 0;
+  for(int i=0; i<num_optimizations; i++){
+    if(pruned[i]) continue;
+    if(num_kept != static_cast<arma::uword>(i)) optimizations[num_kept] = std::move(optimizations[i]);
+    num_kept++;
+  }
+  optimizations.erase(optimizations.begin() + num_kept, optimizations.end());
+
   // Report finished
   if( p.is_aborted() ){
     pb.complete("Optimization runs interrupted", false);
@@ -425,23 +746,19 @@ void ac_relaxOptimizations(
     pb.complete("Optimization runs complete");
   }
 
+  // Report pruned runs
+  if(options.report_progress && options.prune_runs) report_pruned_runs(race);
+
 }
 
 
-// [[Rcpp::export]]
-std::vector<AcOptimization> ac_runOptimizations(
-    const AcTiterTable &titertable,
-    const arma::vec &colbases,
+// Set the dimensions to relax optimizations through, when doing dimensional
+// annealing optimizations start in 5 dimensions
+arma::uvec ac_optimization_dim_set(
     const arma::uword &num_dims,
-    const arma::uword &num_optimizations,
     const AcOptimizerOptions &options
 ){
 
-  // Get table distance matrix and titer type matrix
-  arma::mat tabledist_matrix = titertable.table_distances(colbases);
-  arma::umat titertype_matrix = titertable.get_titer_types();
-
-  // Set dimensions to cycle through, for e.g. dimensional annealing
   arma::uvec dim_set { num_dims };
 
   if (options.dim_annealing && num_dims < 5) {
@@ -450,42 +767,167 @@ std::vector<AcOptimization> ac_runOptimizations(
     dim_set(1) = num_dims;
   }
 
-  // Generate optimizations with random starting coords
-  std::vector<AcOptimization> optimizations = ac_generateOptimizations(
-    colbases,
+  return dim_set;
+
+}
+
+
+// Run a single optimization, randomizing its starting coordinates from the
+// random number stream of its run number as in ac_generateOptimizations() and
+// relaxing it, "annealing" through the dimensions of dim_set. Runs only race
+// in the final dimension of dim_set, since stresses in higher dimensions are
+// not comparable. When racing, pruned is set to whether the run was abandoned
+// unless it is nullptr.
+AcOptimization ac_runOptimization(
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    const arma::uvec &dim_set,
+    const double &coord_boxsize,
+    const arma::uword &run_number,
+    const AcOptimizerOptions &options,
+    AcOptimizerRace *race,
+    bool *pruned
+){
+
+  // Randomize starting coordinates
+  AcOptimization optimization(
+    dim_set(0),
+    tabledist_matrix.n_rows,
+    tabledist_matrix.n_cols
+  );
+  AcRNG rng(options.seed, run_number + 1);
+  optimization.randomizeCoords(coord_boxsize, rng);
+
+  // Relax, reducing dimensions between relaxations
+  bool run_pruned = false;
+  for (arma::uword j=0; j<dim_set.n_elem; j++) {
+    bool final_stage = j + 1 == dim_set.n_elem;
+    run_pruned = optimization.relax_from_raw_matrices(
+      tabledist_matrix,
+      titertype_matrix,
+      options,
+      arma::uvec(),
+      arma::uvec(),
+      final_stage ? race : nullptr
+    );
+    if (!final_stage) {
+      optimization.reduceDimensions(dim_set(j + 1));
+    }
+  }
+
+  if(pruned) *pruned = run_pruned;
+  return optimization;
+
+}
+
+
+// Run optimizations keeping the num_kept lowest stress runs, sorted by
+// stress. Each run is offered to a bounded heap as it finishes so memory use
+// does not grow with the number of runs when only the best are kept. Runs
+// abandoned when racing are discarded.
+std::vector<AcOptimization> ac_runOptimizationsKeepBest(
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    const arma::uvec &dim_set,
+    const arma::uword &num_optimizations,
+    const arma::uword &num_kept,
+    const AcOptimizerOptions &options
+){
+
+  // Set variables
+  int num_threads = ac_num_threads(options.num_cores);
+
+  // Find the box size for random coordinates
+  double coord_boxsize = ac_optimization_boxsize(
     tabledist_matrix,
     titertype_matrix,
     dim_set(0),
-    num_optimizations,
     options
   );
 
-  // Now cycle "anneal" through the dimensions
-  for (arma::uword i=0; i<dim_set.n_elem; i++) {
+  // Set progress bar
+  if(options.report_progress){
+    if(num_kept < num_optimizations) REprintf("Performing %d optimizations using %d threads, keeping the best %d\n", (int)num_optimizations, num_threads, (int)num_kept);
+    else                             REprintf("Performing %d optimizations using %d threads\n", (int)num_optimizations, num_threads);
+  }
+  AcProgressBar pb(options.progress_bar_length, options.report_progress);
+  Progress p(num_optimizations, true, pb);
 
-    // Relax the optimizations
-    ac_relaxOptimizations(
-      optimizations,
-      colbases,
-      tabledist_matrix,
-      titertype_matrix,
-      options
-    );
+  // Optionally race the runs against each other
+  AcOptimizerRace race;
+  AcOptimizerRace *race_ptr = options.prune_runs ? &race : nullptr;
 
-    // Reduce dimensions to next step if doing dimensional annealing
-    if (i + 1 < dim_set.n_elem) {
-      for(auto &optimization : optimizations){
-        optimization.reduceDimensions(dim_set(i + 1));
-      }
+  // Run the optimizations
+  AcOptimizationHeap best_optimizations(num_kept);
+
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+  for(int i=0; i<static_cast<int>(num_optimizations); i++){
+
+    if( !p.check_abort() ){
+      p.increment();
+      bool pruned = false;
+      AcOptimization optimization = ac_runOptimization(
+        tabledist_matrix,
+        titertype_matrix,
+        dim_set,
+        coord_boxsize,
+        i,
+        options,
+        race_ptr,
+        &pruned
+      );
+      if(!pruned) best_optimizations.offer(i, std::move(optimization));
     }
 
   }
 
-  // Sort the optimizations by stress
-  sort_optimizations_by_stress(optimizations);
+  // Report finished
+  if( p.is_aborted() ){
+    pb.complete("Optimization runs interrupted", false);
+  } else {
+    pb.complete("Optimization runs complete");
+  }
+
+  // Report pruned runs
+  if(options.report_progress && options.prune_runs) report_pruned_runs(race);
+
+  return best_optimizations.take();
+
+}
+
+
+// [[Rcpp::export]]
+std::vector<AcOptimization> ac_runOptimizations(
+    const AcTiterTable &titertable,
+    const arma::vec &colbases,
+    const arma::uword &num_dims,
+    const arma::uword &num_optimizations,
+    const AcOptimizerOptions &options
+){
+
+  // Get table distance matrix and titer type matrix
+  arma::mat tabledist_matrix = titertable.table_distances(colbases);
+  arma::umat titertype_matrix = titertable.get_titer_types();
+
+  // Keep every run unless only the best runs were asked for
+  arma::uword num_kept = num_optimizations;
+  if (options.keep_best_optimizations > 0 &&
+      static_cast<arma::uword>(options.keep_best_optimizations) < num_optimizations) {
+    num_kept = options.keep_best_optimizations;
+  }
+
+  // Run the optimizations, sorted by stress
+  std::vector<AcOptimization> optimizations = ac_runOptimizationsKeepBest(
+    tabledist_matrix,
+    titertype_matrix,
+    ac_optimization_dim_set(num_dims, options),
+    num_optimizations,
+    num_kept,
+    options
+  );
 
   // Realign optimizations to the first one
-  align_optimizations(optimizations);
+  align_optimizations(optimizations, options.num_cores);
 
   // Return the optimizations
   return optimizations;
@@ -26,6 +26,32 @@ void ac_relaxOptimizations(
     const AcOptimizerOptions &options
 );
 
+// Setting the dimensions to relax optimizations through
+arma::uvec ac_optimization_dim_set(
+    const arma::uword &num_dims,
+    const AcOptimizerOptions &options
+);
+
+// Finding the size of the box to randomize starting coordinates within
+double ac_optimization_boxsize(
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    const int &num_dims,
+    const AcOptimizerOptions &options
+);
+
+// Running a single optimization from its own random number stream
+AcOptimization ac_runOptimization(
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    const arma::uvec &dim_set,
+    const double &coord_boxsize,
+    const arma::uword &run_number,
+    const AcOptimizerOptions &options,
+    AcOptimizerRace *race = nullptr,
+    bool *pruned = nullptr
+);
+
 // Running optimizations
 std::vector<AcOptimization> ac_runOptimizations(
     const AcTiterTable &titertable,
@@ -40,4 +66,9 @@ void sort_optimizations_by_stress(
     std::vector<AcOptimization> &optimizations
 );
 
+void partial_sort_optimizations_by_stress(
+    std::vector<AcOptimization> &optimizations,
+    arma::uword num_best
+);
+
 #endif
@@ -1,11 +1,13 @@
 
 #include <RcppArmadillo.h>
+#include <numeric>
 #include "acmap_optimization.h"
+#include "utils_parallel.h"
 
-// For optimization sorting
+// For optimization sorting, optimizations with a non-finite stress go last
 bool compare_optimization_stress(
-    AcOptimization opt1,
-    AcOptimization opt2
+    const AcOptimization &opt1,
+    const AcOptimization &opt2
 ){
   if(!std::isfinite(opt1.stress)){
     return false;
@@ -16,28 +18,102 @@ bool compare_optimization_stress(
   return (opt1.stress < opt2.stress);
 }
 
+// Reorder optimizations by moving them into the order of the indices given,
+// any optimizations not indexed follow in their original order
+void reorder_optimizations(
+    std::vector<AcOptimization> &optimizations,
+    const std::vector<arma::uword> &order,
+    const arma::uword &num_ordered
+){
+
+  std::vector<bool> moved(optimizations.size(), false);
+  std::vector<AcOptimization> reordered;
+  reordered.reserve(optimizations.size());
+
+  for(arma::uword i=0; i<num_ordered; i++){
+    reordered.push_back( std::move(optimizations[order[i]]) );
+    moved[order[i]] = true;
+  }
+  for(arma::uword i=0; i<optimizations.size(); i++){
+    if(!moved[i]) reordered.push_back( std::move(optimizations[i]) );
+  }
+
+  optimizations.swap(reordered);
+
+}
+
+// Sort optimizations by stress, sorting a permutation of indices so that
+// optimizations are only moved once rather than copied for each comparison
 void sort_optimizations_by_stress(
     std::vector<AcOptimization> &optimizations
 ){
 
-  sort(
-    optimizations.begin(),
-    optimizations.end(),
-    compare_optimization_stress
+  std::vector<arma::uword> order(optimizations.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(
+    order.begin(),
+    order.end(),
+    [&](arma::uword i, arma::uword j){
+      return compare_optimization_stress(optimizations[i], optimizations[j]);
+    }
   );
 
+  reorder_optimizations(optimizations, order, order.size());
+
 }
 
+// Move just the lowest stress optimizations to the front in order of stress,
+// for when only the best runs are needed
+void partial_sort_optimizations_by_stress(
+    std::vector<AcOptimization> &optimizations,
+    arma::uword num_best
+){
+
+  num_best = std::min(num_best, static_cast<arma::uword>(optimizations.size()));
 
-// For optimization alignment
+  std::vector<arma::uword> order(optimizations.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::partial_sort(
+    order.begin(),
+    order.begin() + num_best,
+    order.end(),
+    [&](arma::uword i, arma::uword j){
+      if(compare_optimization_stress(optimizations[i], optimizations[j])) return true;
+      if(compare_optimization_stress(optimizations[j], optimizations[i])) return false;
+      return i < j;
+    }
+  );
+
+  reorder_optimizations(optimizations, order, num_best);
+
+}
+
+
+// For optimization alignment, optimizations are aligned in parallel to the
+// coordinates of the first one, which are centred only once
 void align_optimizations(
-    std::vector<AcOptimization> &optimizations
+    std::vector<AcOptimization> &optimizations,
+    const int &num_cores
 ){
 
   if(optimizations.size() > 1){
+
+    ProcrustesTarget target = ac_procrustes_target(
+      optimizations[0].ptBaseCoords()
+    );
+
+    // Check input before the parallel region since errors cannot be raised from it
+    for(arma::uword i=1; i<optimizations.size(); i++){
+      if(static_cast<arma::uword>(optimizations[i].num_ags() + optimizations[i].num_sr()) != target.coords.n_rows){
+        Rcpp::stop("Optimizations do not have the same number of points");
+      }
+    }
+
+    #pragma omp parallel for schedule(dynamic) num_threads(ac_num_threads(num_cores))
     for(arma::uword i=1; i<optimizations.size(); i++){
-      optimizations[i].alignToOptimization(optimizations[0]);
+      optimizations[i].alignToProcrustesTarget(target);
     }
+
   }
 
 }
@@ -1,18 +1,124 @@
 
 #include <RcppArmadillo.h>
+#include <algorithm>
+#include <functional>
 #include "acmap_optimization.h"
 
 #ifndef Racmacs__ac_optimization__h
 #define Racmacs__ac_optimization__h
 
+bool compare_optimization_stress(
+    const AcOptimization &opt1,
+    const AcOptimization &opt2
+);
+
 void sort_optimizations_by_stress(
     std::vector<AcOptimization> &optimizations
 );
 
+void partial_sort_optimizations_by_stress(
+    std::vector<AcOptimization> &optimizations,
+    arma::uword num_best
+);
+
+
+// A bounded collection of the lowest stress optimizations, that parallel
+// workers can offer optimizations to as they finish so that only the best
+// runs are ever held in memory. Ties in stress go to the lower run number so
+// the runs kept do not depend on the order in which they finish.
+class AcOptimizationHeap {
+
+  public:
+
+    // Constructor
+    AcOptimizationHeap(
+      const arma::uword &max_size
+    ):
+      max_size_(max_size)
+    {
+      runs_.reserve(max_size);
+      optimizations_.reserve(max_size);
+    }
+
+    // Offer an optimization to the heap, keeping it if it is among the best
+    void offer(
+      const arma::uword &run,
+      AcOptimization &&optimization
+    ){
+
+      if(max_size_ == 0) return;
+
+      #pragma omp critical(ac_optimization_heap)
+      {
+
+        if(order_.size() < max_size_){
+
+          order_.push_back(order_.size());
+          runs_.push_back(run);
+          optimizations_.push_back( std::move(optimization) );
+          std::push_heap(order_.begin(), order_.end(), heap_order());
+
+        } else if(better(run, optimization, runs_[order_.front()], optimizations_[order_.front()])){
+
+          // Replace the worst optimization kept
+          std::pop_heap(order_.begin(), order_.end(), heap_order());
+          runs_[order_.back()] = run;
+          optimizations_[order_.back()] = std::move(optimization);
+          std::push_heap(order_.begin(), order_.end(), heap_order());
+
+        }
+
+      }
+
+    }
+
+    // Take the optimizations kept, sorted by stress
+    std::vector<AcOptimization> take(){
+
+      std::sort_heap(order_.begin(), order_.end(), heap_order());
+      std::vector<AcOptimization> out;
+      out.reserve(order_.size());
+      for(auto &i : order_) out.push_back( std::move(optimizations_[i]) );
+
+      order_.clear();
+      runs_.clear();
+      optimizations_.clear();
+      return out;
+
+    }
+
+  private:
+
+    arma::uword max_size_;
+    std::vector<arma::uword> order_;
+    std::vector<arma::uword> runs_;
+    std::vector<AcOptimization> optimizations_;
+
+    static bool better(
+      const arma::uword &run1,
+      const AcOptimization &opt1,
+      const arma::uword &run2,
+      const AcOptimization &opt2
+    ){
+      if(compare_optimization_stress(opt1, opt2)) return true;
+      if(compare_optimization_stress(opt2, opt1)) return false;
+      return run1 < run2;
+    }
+
+    // Ordering of kept optimizations from best to worst, as a heap this keeps
+    // the worst optimization at the front
+    std::function<bool(arma::uword, arma::uword)> heap_order() const {
+      return [this](arma::uword i, arma::uword j){
+        return better(runs_[i], optimizations_[i], runs_[j], optimizations_[j]);
+      };
+    }
+
+};
 
 // For optimization alignment
 void align_optimizations(
-    std::vector<AcOptimization> &optimizations
+    std::vector<AcOptimization> &optimizations,
+    const int &num_cores
 );
 
 #endif
@@ -11,6 +11,11 @@ struct AcOptimizerOptions {
   int num_cores;
   bool report_progress;
   int progress_bar_length;
+  unsigned int seed;
+  bool prune_runs;
+  int prune_interval;
+  double prune_threshold;
+  int keep_best_optimizations;
 
 };
 
@@ -5,6 +5,52 @@
 #ifndef Racmacs__ac_relax_coords__h
 #define Racmacs__ac_relax_coords__h
 
+// Shared state for optimization runs racing against each other, runs are
+// abandoned when their stress is clearly worse than the best finished run
+class AcOptimizerRace {
+
+  private:
+
+    double best_stress = arma::datum::inf;
+
+  public:
+
+    // Iterations at which each pruned run was abandoned
+    std::vector<int> pruned_iterations;
+
+    // Get the lowest stress of any finished run
+    double get_best_stress() {
+      double stress;
+      #pragma omp atomic read
+      stress = best_stress;
+      return stress;
+    }
+
+    // Record the stress of a finished run
+    void record_stress(
+        const double &stress
+    ){
+      #pragma omp critical(ac_optimizer_race)
+      {
+        if(stress < best_stress){
+          #pragma omp atomic write
+          best_stress = stress;
+        }
+      }
+    }
+
+    // Record a pruned run
+    void record_pruned(
+        const int &iteration
+    ){
+      #pragma omp critical(ac_optimizer_race)
+      {
+        pruned_iterations.push_back(iteration);
+      }
+    }
+
+};
+
 double ac_relax_coords(
     const arma::mat &tabledist_matrix,
     const arma::umat &titertype_matrix,
@@ -15,4 +61,18 @@ double ac_relax_coords(
     const arma::uvec &fixed_sera
 );
 
+// Relaxing coordinates while racing against other runs, race can be nullptr
+// for no racing, pruned is set to whether the run was abandoned
+double ac_relax_coords_with_race(
+    const arma::mat &tabledist_matrix,
+    const arma::umat &titertype_matrix,
+    arma::mat &ag_coords,
+    arma::mat &sr_coords,
+    const AcOptimizerOptions &options,
+    const arma::uvec &fixed_antigens,
+    const arma::uvec &fixed_sera,
+    AcOptimizerRace *race,
+    bool *pruned = nullptr
+);
+
 #endif
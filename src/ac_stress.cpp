@@ -90,3 +90,92 @@ double inc_base(
 }
 
 
+// Batched stress for measurable titers
+double ac_batchStress_measurable(
+    const double *map_dists,
+    const double *table_dists,
+    const arma::uword &n
+  ){
+
+  double stress = 0;
+
+  #pragma omp simd reduction(+:stress)
+  for(arma::uword i = 0; i < n; ++i) {
+    double x = table_dists[i] - map_dists[i];
+    stress += x*x;
+  }
+
+  return stress;
+
+}
+
+
+// Batched stress for less than titers
+double ac_batchStress_lessthan(
+    const double *map_dists,
+    const double *table_dists,
+    const arma::uword &n
+  ){
+
+  double stress = 0;
+
+  #pragma omp simd reduction(+:stress)
+  for(arma::uword i = 0; i < n; ++i) {
+    double x = table_dists[i] - map_dists[i] + 1;
+    double sig = 1/(1+exp(-10*x));
+    stress += x*x*sig;
+  }
+
+  return stress;
+
+}
+
+
+// Batched stress and inc_base for measurable titers
+double ac_batchStress_inc_base_measurable(
+    const double *map_dists,
+    const double *table_dists,
+    double *ibases,
+    const arma::uword &n
+  ){
+
+  double stress = 0;
+
+  #pragma omp simd reduction(+:stress)
+  for(arma::uword i = 0; i < n; ++i) {
+    // Deal with 0 map distance without branching
+    double map_dist = map_dists[i] == 0 ? 1e-5 : map_dists[i];
+    double x = table_dists[i] - map_dist;
+    stress += x*x;
+    ibases[i] = (2*x) / map_dist;
+  }
+
+  return stress;
+
+}
+
+
+// Batched stress and inc_base for less than titers
+double ac_batchStress_inc_base_lessthan(
+    const double *map_dists,
+    const double *table_dists,
+    double *ibases,
+    const arma::uword &n
+  ){
+
+  double stress = 0;
+
+  #pragma omp simd reduction(+:stress)
+  for(arma::uword i = 0; i < n; ++i) {
+    // Deal with 0 map distance without branching
+    double map_dist = map_dists[i] == 0 ? 1e-5 : map_dists[i];
+    double x = table_dists[i] - map_dist + 1;
+    double sig = 1/(1+exp(-10*x));
+    stress += x*x*sig;
+    ibases[i] = (10*x*x*sig*(1-sig) + 2*x*sig) / map_dist;
+  }
+
+  return stress;
+
+}
+
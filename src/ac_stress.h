@@ -24,4 +24,33 @@ double inc_base(
   unsigned int &titer_type
 );
 
+// Batched point stress functions, these work on titers of a single type at a
+// time and are written without branches so that they can be vectorised
+double ac_batchStress_measurable(
+  const double *map_dists,
+  const double *table_dists,
+  const arma::uword &n
+);
+
+double ac_batchStress_lessthan(
+  const double *map_dists,
+  const double *table_dists,
+  const arma::uword &n
+);
+
+// Batched point stress functions also setting inc_base for the gradient
+double ac_batchStress_inc_base_measurable(
+  const double *map_dists,
+  const double *table_dists,
+  double *ibases,
+  const arma::uword &n
+);
+
+double ac_batchStress_inc_base_lessthan(
+  const double *map_dists,
+  const double *table_dists,
+  double *ibases,
+  const arma::uword &n
+);
+
 #endif
@@ -1,63 +1,159 @@
-
 #include <RcppArmadillo.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+// [[Rcpp::plugins(openmp)]]
+
 #include "acmap_titers.h"
 #include "ac_stress.h"
 #include "ac_stress_blobs.h"
+#include "utils_parallel.h"
 
-// For calculating the point stress at each grid point
-double point_stress(
-    arma::vec &mapdists,
-    arma::vec &tabledists,
-    arma::uvec &titertypes
-) {
+// The partner points of a point being searched over, held as separate
+// coordinate arrays so that a row of grid points can be evaluated against each
+// partner in turn with a vectorised inner loop. Titers that never contribute
+// to the stress are left out, otherwise partners stay in their original order
+// so that stresses are summed in the same order as ac_ptStress() over a table.
+struct StressBlobPartners {
 
-  double stress = 0;
+  arma::uword dims;
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> z;
+  std::vector<double> tabledists;
+  std::vector<unsigned int> titertypes;
 
-  for(arma::uword i=0; i<mapdists.n_elem; i++){
+  StressBlobPartners(
+    const arma::mat &coords,
+    const arma::vec &tabledists_in,
+    const arma::uvec &titertypes_in
+  ):
+    dims(coords.n_cols)
+  {
 
-    // Skip unmeasured titers
-    if(titertypes(i) == 0){
-      continue;
+    for(arma::uword n=0; n<coords.n_rows; n++){
+      if(titertypes_in(n) != 1 && titertypes_in(n) != 2) continue;
+      x.push_back(coords(n, 0));
+      y.push_back(coords(n, 1));
+      z.push_back(dims == 3 ? coords(n, 2) : 0);
+      tabledists.push_back(tabledists_in(n));
+      titertypes.push_back(titertypes_in(n));
     }
 
-    // Now calculate the stress
-    stress += ac_ptStress(
-      mapdists(i),
-      tabledists(i),
-      titertypes(i)
-    );
-
   }
 
-  return stress;
+  arma::uword size() const { return titertypes.size(); }
+
+};
+
+
+// Calculate the point stress along a row of grid points, at the x coordinates
+// given and a fixed y and z coordinate
+void grid_row_stress(
+    const StressBlobPartners &partners,
+    const double *xs,
+    const arma::uword &n,
+    const double &y,
+    const double &z,
+    double *stress
+) {
+
+  std::fill(stress, stress + n, 0.0);
+
+  for(arma::uword p=0; p<partners.size(); p++){
+
+    const double px = partners.x[p];
+    const double dy = y - partners.y[p];
+    const double dy2 = dy*dy;
+    const double dz = z - partners.z[p];
+    const double dz2 = partners.dims == 3 ? dz*dz : 0;
+    const double tabledist = partners.tabledists[p];
+
+    if(partners.titertypes[p] == 1){
+
+      // Measurable titer
+      #pragma omp simd
+      for(arma::uword c=0; c<n; c++){
+        double dx = xs[c] - px;
+        double dist = dx*dx + dy2;
+        if(partners.dims == 3) dist += dz2;
+        double x = tabledist - sqrt(dist);
+        stress[c] += x*x;
+      }
+
+    } else {
+
+      // Less than titer
+      #pragma omp simd
+      for(arma::uword c=0; c<n; c++){
+        double dx = xs[c] - px;
+        double dist = dx*dx + dy2;
+        if(partners.dims == 3) dist += dz2;
+        double x = tabledist - sqrt(dist) + 1;
+        stress[c] += x*x*(1/(1+exp(-10*x)));
+      }
+
+    }
+
+  }
 
 }
 
-// For updating the map distances
-void update_map_dists(
-    arma::vec &mapdists,
-    arma::vec &testcoords,
-    arma::mat &coords
-){
 
-  for(arma::uword n=0; n<mapdists.n_elem; n++){
-    double dist = 0;
-    for(arma::uword i = 0; i < coords.n_cols; ++i) {
-      dist += pow(testcoords(i) - coords(n, i), 2);
+// A lower bound on the point stress anywhere within radius of a position.
+// Each titer's stress is bounded over the range of map distances it could take.
+double point_stress_lower_bound(
+    const StressBlobPartners &partners,
+    const double &x,
+    const double &y,
+    const double &z,
+    const double &radius
+) {
+
+  double stress = 0;
+
+  for(arma::uword p=0; p<partners.size(); p++){
+
+    double dx = x - partners.x[p];
+    double dy = y - partners.y[p];
+    double dz = partners.dims == 3 ? z - partners.z[p] : 0;
+    double mapdist = sqrt(dx*dx + dy*dy + dz*dz);
+    double dist_lower = std::max(mapdist - radius, 0.0);
+    double dist_upper = mapdist + radius;
+    double tabledist = partners.tabledists[p];
+    double v;
+
+    if(partners.titertypes[p] == 1){
+      // Measurable titer, zero if the table distance can be matched
+      if(tabledist < dist_lower)      v = dist_lower - tabledist;
+      else if(tabledist > dist_upper) v = tabledist - dist_upper;
+      else                            v = 0;
+      stress += v*v;
+    } else {
+      // Less than titer, the penalty only increases with v where v > 0
+      v = tabledist - dist_upper + 1;
+      if(v > 0) stress += v*v/(1+exp(-10*v));
     }
-    mapdists(n) = sqrt(dist);
+
   }
 
+  return stress;
+
 }
 
-// [[Rcpp::export]]
-StressBlobGrid ac_stress_blob_grid(
-    arma::vec testcoords,
-    arma::mat coords,
-    arma::vec tabledists,
-    arma::uvec titertypes,
-    double stress_lim,
-    double grid_spacing
+
+// Calculate the stress blob grid of a point, grid rows are evaluated in
+// parallel across num_threads threads
+StressBlobGrid stress_blob_grid(
+    const arma::vec &testcoords,
+    const arma::mat &coords,
+    const arma::vec &tabledists,
+    const arma::uvec &titertypes,
+    const double &stress_lim,
+    const double &grid_spacing,
+    const bool &adaptive,
+    const int &num_threads
 ){
 
   // Get the map dimensions
@@ -81,38 +177,132 @@ StressBlobGrid ac_stress_blob_grid(
     zcoords = arma::vec{0};
   }
 
+  // Setup partner points
+  StressBlobPartners partners(coords, tabledists, titertypes);
+
   // Calculate the initial point stress
-  arma::vec mapdists(coords.n_rows);
-  update_map_dists(mapdists, testcoords, coords);
-  double base_stress = point_stress(
-    mapdists,
-    tabledists,
-    titertypes
+  double base_stress;
+  grid_row_stress(
+    partners,
+    testcoords.memptr(), 1,
+    testcoords(1),
+    mapdims == 3 ? testcoords(2) : 0,
+    &base_stress
   );
 
-  // Setup results grid
-  arma::cube stressmat(xcoords.n_elem, ycoords.n_elem, zcoords.n_elem);
-  for(arma::uword i=0; i<xcoords.n_elem; i++){
-    for(arma::uword j=0; j<ycoords.n_elem; j++){
-      for(arma::uword k=0; k<zcoords.n_elem; k++){
-
-        // Update map distances
-        testcoords(0) = xcoords(i);
-        testcoords(1) = ycoords(j);
-        if(mapdims == 3){
-          testcoords(2) = zcoords(k);
+  // Setup results grid, rows along x are contiguous
+  const arma::uword nx = xcoords.n_elem;
+  const arma::uword ny = ycoords.n_elem;
+  const arma::uword nz = zcoords.n_elem;
+  arma::cube stressmat(nx, ny, nz);
+
+  if(!adaptive){
+
+    // Evaluate every grid row
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for(int r=0; r<static_cast<int>(ny*nz); r++){
+      arma::uword j = r % ny;
+      arma::uword k = r / ny;
+      grid_row_stress(
+        partners,
+        xcoords.memptr(), nx,
+        ycoords(j), zcoords(k),
+        stressmat.slice_colptr(k, j)
+      );
+    }
+
+  } else {
+
+    // Work through coarse blocks of grid points, bounding the stress within
+    // each block and only evaluating its points where the bound shows they
+    // could fall below the stress limit or below the starting stress. Points
+    // in other blocks are set to the bound, which is above either level.
+    const arma::uword block_size = 8;
+    const arma::uword nbx = (nx + block_size - 1) / block_size;
+    const arma::uword nby = (ny + block_size - 1) / block_size;
+    const arma::uword nbz = (nz + block_size - 1) / block_size;
+    double level = std::max(stress_lim, 0.0);
+    arma::Cube<unsigned char> evaluated(nx, ny, nz, arma::fill::zeros);
+
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+    for(int b=0; b<static_cast<int>(nbx*nby*nbz); b++){
+
+      arma::uword i0 = (b % nbx)*block_size;
+      arma::uword j0 = ((b / nbx) % nby)*block_size;
+      arma::uword k0 = (b / (nbx*nby))*block_size;
+      arma::uword i1 = std::min(i0 + block_size, nx) - 1;
+      arma::uword j1 = std::min(j0 + block_size, ny) - 1;
+      arma::uword k1 = std::min(k0 + block_size, nz) - 1;
+
+      // Bound the stress from the block centre
+      double xhalf = (xcoords(i1) - xcoords(i0)) / 2;
+      double yhalf = (ycoords(j1) - ycoords(j0)) / 2;
+      double zhalf = (zcoords(k1) - zcoords(k0)) / 2;
+      double radius = std::sqrt(xhalf*xhalf + yhalf*yhalf + zhalf*zhalf)*(1 + 1e-9) + 1e-12;
+      double bound = point_stress_lower_bound(
+        partners,
+        xcoords(i0) + xhalf,
+        ycoords(j0) + yhalf,
+        zcoords(k0) + zhalf,
+        radius
+      );
+
+      bool skip_block = bound - base_stress > level;
+      for(arma::uword k=k0; k<=k1; k++){
+        for(arma::uword j=j0; j<=j1; j++){
+          if(skip_block){
+            std::fill(&stressmat(i0, j, k), &stressmat(i1, j, k) + 1, bound);
+          } else {
+            grid_row_stress(
+              partners,
+              xcoords.memptr() + i0, i1 - i0 + 1,
+              ycoords(j), zcoords(k),
+              &stressmat(i0, j, k)
+            );
+            std::fill(&evaluated(i0, j, k), &evaluated(i1, j, k) + 1, 1);
+          }
         }
-        update_map_dists(mapdists, testcoords, coords);
+      }
+
+    }
+
+    // Find skipped neighbours of points below the level, so that contours
+    // interpolated between them are the same as on the full grid
+    std::vector<arma::uword> neighbours;
+    for(arma::uword k=0; k<nz; k++){
+      for(arma::uword j=0; j<ny; j++){
+        for(arma::uword i=0; i<nx; i++){
+
+          if(!evaluated(i,j,k) || !(stressmat(i,j,k) - base_stress <= level)) continue;
 
-        // Calculate point stress
-        stressmat(i,j,k) = point_stress(
-          mapdists,
-          tabledists,
-          titertypes
-        );
+          for(arma::uword nk=(k > 0 ? k - 1 : 0); nk<=std::min(k + 1, nz - 1); nk++){
+            for(arma::uword nj=(j > 0 ? j - 1 : 0); nj<=std::min(j + 1, ny - 1); nj++){
+              for(arma::uword ni=(i > 0 ? i - 1 : 0); ni<=std::min(i + 1, nx - 1); ni++){
+                if(evaluated(ni,nj,nk)) continue;
+                evaluated(ni,nj,nk) = 2;
+                neighbours.push_back(ni + nx*(nj + ny*nk));
+              }
+            }
+          }
 
+        }
       }
     }
+
+    // Then evaluate them
+    #pragma omp parallel for schedule(static) num_threads(num_threads)
+    for(int n=0; n<static_cast<int>(neighbours.size()); n++){
+      arma::uword i = neighbours[n] % nx;
+      arma::uword j = (neighbours[n] / nx) % ny;
+      arma::uword k = neighbours[n] / (nx*ny);
+      grid_row_stress(
+        partners,
+        xcoords.memptr() + i, 1,
+        ycoords(j), zcoords(k),
+        &stressmat(i, j, k)
+      );
+    }
+
   }
 
   // Setup for output
@@ -130,4 +320,116 @@ StressBlobGrid ac_stress_blob_grid(
 }
 
 
+// [[Rcpp::export]]
+StressBlobGrid ac_stress_blob_grid(
+    arma::vec testcoords,
+    arma::mat coords,
+    arma::vec tabledists,
+    arma::uvec titertypes,
+    double stress_lim,
+    double grid_spacing,
+    bool adaptive
+){
+
+  return stress_blob_grid(
+    testcoords,
+    coords,
+    tabledists,
+    titertypes,
+    stress_lim,
+    grid_spacing,
+    adaptive,
+    1
+  );
+
+}
+
+
+// Crop a stress blob grid to the points at or below the stress limit, plus a
+// margin of one grid point so that contours interpolated between points either
+// side of the limit are unchanged. Where no points are below the limit the
+// grid is cropped around its lowest point instead.
+void crop_stress_blob_grid(
+    StressBlobGrid &blobgrid
+){
+
+  arma::cube &grid = blobgrid.grid;
+  if(grid.n_elem == 0) return;
+
+  arma::uword imin = grid.n_rows, imax = 0;
+  arma::uword jmin = grid.n_cols, jmax = 0;
+  arma::uword kmin = grid.n_slices, kmax = 0;
+
+  for(arma::uword k=0; k<grid.n_slices; k++){
+    for(arma::uword j=0; j<grid.n_cols; j++){
+      for(arma::uword i=0; i<grid.n_rows; i++){
+        if(grid(i,j,k) <= blobgrid.stress_lim){
+          imin = std::min(imin, i); imax = std::max(imax, i);
+          jmin = std::min(jmin, j); jmax = std::max(jmax, j);
+          kmin = std::min(kmin, k); kmax = std::max(kmax, k);
+        }
+      }
+    }
+  }
+
+  if(imin > imax){
+    arma::uvec sub = arma::ind2sub( arma::size(grid), grid.index_min() );
+    imin = imax = sub(0);
+    jmin = jmax = sub(1);
+    kmin = kmax = sub(2);
+  }
+
+  // Add the margin
+  imin = imin > 0 ? imin - 1 : 0; imax = std::min(imax + 1, grid.n_rows - 1);
+  jmin = jmin > 0 ? jmin - 1 : 0; jmax = std::min(jmax + 1, grid.n_cols - 1);
+  kmin = kmin > 0 ? kmin - 1 : 0; kmax = std::min(kmax + 1, grid.n_slices - 1);
+
+  grid = arma::cube(grid.subcube(imin, jmin, kmin, imax, jmax, kmax));
+  blobgrid.xcoords = arma::vec(blobgrid.xcoords.subvec(imin, imax));
+  blobgrid.ycoords = arma::vec(blobgrid.ycoords.subvec(jmin, jmax));
+  blobgrid.zcoords = arma::vec(blobgrid.zcoords.subvec(kmin, kmax));
+
+}
+
+
+// Calculate the stress blob grids of a set of test points against their
+// partner points, e.g. every antigen against the sera. Test points are shared
+// out between threads, or when there are fewer test points than threads the
+// rows of each grid are. Grids are cropped to the region around each blob so
+// only that is returned.
+// [[Rcpp::export]]
+std::vector<StressBlobGrid> ac_stress_blob_grids(
+    const arma::mat &test_coords,
+    const arma::mat &coords,
+    const arma::mat &tabledists,
+    const arma::umat &titertypes,
+    double stress_lim,
+    double grid_spacing,
+    int num_cores
+){
+
+  int num_points = test_coords.n_rows;
+  int num_threads = ac_num_threads(num_cores);
+  int point_threads = num_points >= num_threads ? num_threads : 1;
+  int grid_threads = num_points >= num_threads ? 1 : num_threads;
 
+  std::vector<StressBlobGrid> grids(num_points);
+
+  #pragma omp parallel for schedule(dynamic) num_threads(point_threads)
+  for(int i=0; i<num_points; i++){
+    grids[i] = stress_blob_grid(
+      test_coords.row(i).as_col(),
+      coords,
+      tabledists.row(i).as_col(),
+      titertypes.row(i).as_col(),
+      stress_lim,
+      grid_spacing,
+      true,
+      grid_threads
+    );
+    crop_stress_blob_grid(grids[i]);
+  }
+
+  return grids;
+
+}
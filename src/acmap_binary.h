@@ -0,0 +1,334 @@
+
+#include <RcppArmadillo.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include "utils_file.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef Racmacs__acmap_binary__h
+#define Racmacs__acmap_binary__h
+
+// The binary .acb map format is a header followed by a series of length
+// prefixed arrays, each padded to 8 bytes. Strings are held once in a string
+// table and referred to by index, so per point metadata is stored as columns
+// of string indices alongside numeric columns.
+//
+// Header:
+//   char[8]  magic "ACMAPBIN"
+//   uint32   format version
+//   uint32   byte order mark 0x01020304
+//   uint64   number of antigens, sera, titer layers, optimizations, strings
+//
+// String table:
+//   uint64[] offsets of each string, with a final offset marking the end
+//   char[]   string data
+//
+// Map data then follows as written by acmap_to_binary()
+static const char acmap_binary_magic[8] = { 'A', 'C', 'M', 'A', 'P', 'B', 'I', 'N' };
+static const uint32_t acmap_binary_version = 1;
+static const uint32_t acmap_binary_bom = 0x01020304;
+
+
+// Table of unique strings, referred to by index
+class AcBinaryStringTable {
+
+  public:
+
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> indices;
+
+    // Get the index of a string, adding it to the table if not yet present
+    uint32_t index(
+        const std::string &str
+    ){
+      auto found = indices.find(str);
+      if(found != indices.end()) return found->second;
+      uint32_t i = strings.size();
+      indices.emplace(str, i);
+      strings.push_back(str);
+      return i;
+    }
+
+};
+
+
+// Write binary map data to a file
+class AcBinaryWriter {
+
+  private:
+
+    FILE *fp;
+    uint64_t pos;
+    AcTempFile tempfile;
+
+  public:
+
+    // Constructor, the file is written to a temporary file that only
+    // replaces filepath once closed without errors
+    AcBinaryWriter(
+      const std::string &filepath
+    ):
+      pos(0),
+      tempfile(filepath)
+    {
+      fp = fopen(tempfile.temppath.c_str(), "wb");
+      if(fp == NULL) Rcpp::stop("File '" + filepath + "' could not be opened for writing");
+    }
+
+    // Destructor
+    ~AcBinaryWriter(){
+      if(fp != NULL) fclose(fp);
+    }
+
+    // Close the file, checking for errors, and replace filepath with it
+    void close(){
+      int err = fclose(fp);
+      fp = NULL;
+      if(err != 0) Rcpp::stop("Failed to write file");
+      tempfile.commit();
+    }
+
+    // Write raw bytes
+    void write(
+        const void *data,
+        const uint64_t &nbytes
+    ){
+      if(nbytes == 0) return;
+      if(fwrite(data, 1, nbytes, fp) != nbytes) Rcpp::stop("Failed to write file");
+      pos += nbytes;
+    }
+
+    // Pad with zeros to the next 8 byte boundary
+    void pad(){
+      static const char zeros[8] = { 0 };
+      write(zeros, (8 - pos % 8) % 8);
+    }
+
+    // Write a single value
+    template <typename T>
+    void write_value(
+        const T &value
+    ){
+      write(&value, sizeof(T));
+    }
+
+    // Write a length prefixed array
+    template <typename T>
+    void write_array(
+        const T *data,
+        const uint64_t &n
+    ){
+      write_value<uint64_t>(n);
+      write(data, n*sizeof(T));
+      pad();
+    }
+
+    template <typename T>
+    void write_array(
+        const std::vector<T> &data
+    ){
+      write_array(data.data(), data.size());
+    }
+
+    void write_array(
+        const arma::mat &data
+    ){
+      write_array(data.memptr(), data.n_elem);
+    }
+
+    // Write the string table
+    void write_string_table(
+        const AcBinaryStringTable &table
+    ){
+      std::vector<uint64_t> offsets(table.strings.size() + 1, 0);
+      for(uint64_t i=0; i<table.strings.size(); i++){
+        offsets[i + 1] = offsets[i] + table.strings[i].size();
+      }
+      write(offsets.data(), offsets.size()*sizeof(uint64_t));
+      for(auto &str : table.strings){
+        write(str.data(), str.size());
+      }
+      pad();
+    }
+
+};
+
+
+// Read binary map data from a file, memory mapping the file where possible
+// and otherwise reading it into memory
+class AcBinaryReader {
+
+  private:
+
+    const char *data;
+    uint64_t size;
+    uint64_t pos;
+    bool mapped;
+    std::vector<char> buffer;
+
+    // Check there are enough bytes left to read
+    void check_available(
+        const uint64_t &nbytes
+    ) const {
+      if(nbytes > size - pos) Rcpp::stop("Binary map file is truncated or corrupt");
+    }
+
+  public:
+
+    // Constructor
+    AcBinaryReader(
+      const std::string &filepath
+    ):
+      data(NULL),
+      size(0),
+      pos(0),
+      mapped(false)
+    {
+
+      #ifndef _WIN32
+      int fd = open(filepath.c_str(), O_RDONLY);
+      if(fd == -1) Rcpp::stop("File '" + filepath + "' could not be opened");
+      struct stat st;
+      if(fstat(fd, &st) == 0 && st.st_size > 0){
+        void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr != MAP_FAILED){
+          data = static_cast<const char*>(addr);
+          size = st.st_size;
+          mapped = true;
+        }
+      }
+      ::close(fd);
+      #endif
+
+      // Fall back to reading the file into memory
+      if(!mapped){
+        FILE *fp = fopen(filepath.c_str(), "rb");
+        if(fp == NULL) Rcpp::stop("File '" + filepath + "' could not be opened");
+        char chunk[65536];
+        size_t nread;
+        while((nread = fread(chunk, 1, sizeof(chunk), fp)) > 0){
+          buffer.insert(buffer.end(), chunk, chunk + nread);
+        }
+        fclose(fp);
+        data = buffer.data();
+        size = buffer.size();
+      }
+
+    }
+
+    // Destructor
+    ~AcBinaryReader(){
+      #ifndef _WIN32
+      if(mapped) munmap(const_cast<char*>(data), size);
+      #endif
+    }
+
+    // Get a pointer to raw bytes, advancing past them
+    const char* read(
+        const uint64_t &nbytes
+    ){
+      check_available(nbytes);
+      const char *out = data + pos;
+      pos += nbytes;
+      return out;
+    }
+
+    // Skip to the next 8 byte boundary
+    void pad(){
+      pos = std::min(pos + (8 - pos % 8) % 8, size);
+    }
+
+    // Get and set the current read position
+    uint64_t tell() const { return pos; }
+    void seek(
+        const uint64_t &newpos
+    ){
+      if(newpos > size) Rcpp::stop("Binary map file is truncated or corrupt");
+      pos = newpos;
+    }
+
+    // Read a single value
+    template <typename T>
+    T read_value(){
+      T value;
+      std::memcpy(&value, read(sizeof(T)), sizeof(T));
+      return value;
+    }
+
+    // Read a length prefixed array, checking its length where known
+    template <typename T>
+    std::vector<T> read_array(){
+      uint64_t n = read_value<uint64_t>();
+      if(n > (size - pos)/sizeof(T)) Rcpp::stop("Binary map file is truncated or corrupt");
+      std::vector<T> out(n);
+      if(n > 0) std::memcpy(out.data(), read(n*sizeof(T)), n*sizeof(T));
+      pad();
+      return out;
+    }
+
+    // Skip over a length prefixed array without copying it
+    template <typename T>
+    void skip_array(){
+      uint64_t n = read_value<uint64_t>();
+      if(n > (size - pos)/sizeof(T)) Rcpp::stop("Binary map file is truncated or corrupt");
+      pos += n*sizeof(T);
+      pad();
+    }
+
+    template <typename T>
+    std::vector<T> read_array(
+        const uint64_t &n_expected
+    ){
+      std::vector<T> out = read_array<T>();
+      if(out.size() != n_expected) Rcpp::stop("Binary map file is truncated or corrupt");
+      return out;
+    }
+
+    // Read a length prefixed array of doubles as a matrix
+    arma::mat read_mat(
+        const uint64_t &n_rows,
+        const uint64_t &n_cols
+    ){
+      uint64_t n = read_value<uint64_t>();
+      if(n_cols != 0 && n_rows > UINT64_MAX / n_cols){
+        Rcpp::stop("Binary map file is truncated or corrupt");
+      }
+      if(n != n_rows*n_cols || n > (size - pos)/sizeof(double)){
+        Rcpp::stop("Binary map file is truncated or corrupt");
+      }
+      arma::mat out(n_rows, n_cols);
+      if(n > 0) std::memcpy(out.memptr(), read(n*sizeof(double)), n*sizeof(double));
+      pad();
+      return out;
+    }
+
+    // Read the string table
+    std::vector<std::string> read_string_table(
+        const uint64_t &num_strings
+    ){
+      if(num_strings >= (size - pos)/sizeof(uint64_t)) Rcpp::stop("Binary map file is truncated or corrupt");
+      std::vector<uint64_t> offsets(num_strings + 1);
+      std::memcpy(offsets.data(), read((num_strings + 1)*sizeof(uint64_t)), (num_strings + 1)*sizeof(uint64_t));
+      const char *chars = read(offsets[num_strings]);
+      std::vector<std::string> strings(num_strings);
+      for(uint64_t i=0; i<num_strings; i++){
+        if(offsets[i] > offsets[i + 1] || offsets[i + 1] > offsets[num_strings]){
+          Rcpp::stop("Binary map file is truncated or corrupt");
+        }
+        strings[i].assign(chars + offsets[i], offsets[i + 1] - offsets[i]);
+      }
+      pad();
+      return strings;
+    }
+
+};
+
+#endif
@@ -283,7 +283,8 @@ class AcMap {
       int targetmap_optnum = 0,
       bool translation = true,
       bool scaling = false,
-      bool align_to_base_coords = false
+      bool align_to_base_coords = false,
+      int num_cores = 1
     ){
 
       // Get matching antigens and sera
@@ -304,26 +305,31 @@ class AcMap {
       }
       arma::mat target_coords = arma::join_cols(target_ag_coords, target_sr_coords);
 
-      // Realign each optimization
+      // Get the source base coords of each optimization
+      std::vector<arma::mat> source_coords;
+      source_coords.reserve(optimizations.size());
       for (auto &optimization : optimizations) {
-
-        // Get the source map base coords
-        arma::mat source_ag_coords = optimization.get_ag_base_coords();
-        arma::mat source_sr_coords = optimization.get_sr_base_coords();
-        arma::mat source_coords = arma::join_cols( source_ag_coords, source_sr_coords );
-
-        // Calculate the procrustes
-        Procrustes pc = ac_procrustes(
-            source_coords,
-            target_coords,
-            translation,
-            scaling
+        source_coords.push_back(
+          arma::join_cols(
+            optimization.get_ag_base_coords(),
+            optimization.get_sr_base_coords()
+          )
         );
+      }
 
-        // Apply it to the optimization
-        optimization.set_transformation( pc.R );
-        optimization.set_translation( pc.tt );
+      // Calculate the procrustes of each to the target
+      std::vector<Procrustes> pcs = ac_procrustes_batch(
+        source_coords,
+        target_coords,
+        translation,
+        scaling,
+        num_cores
+      );
 
+      // Apply them to the optimizations
+      for (arma::uword i=0; i<optimizations.size(); i++) {
+        optimizations[i].set_transformation( pcs[i].R );
+        optimizations[i].set_translation( pcs[i].tt );
       }
 
     }
@@ -3,6 +3,7 @@
 #include "procrustes.h"
 #include "utils.h"
 #include "utils_error.h"
+#include "utils_random.h"
 #include "utils_transformation.h"
 #include "ac_titers.h"
 #include "acmap_titers.h"
@@ -131,7 +132,7 @@ class AcOptimization {
         ac_error("ag_base_coords rows (%i) does not match input rows (%i)", ag_base_coords.n_rows, ag_base_coords_in.n_rows);
       }
       // Update coords
-      ag_base_coords = ag_base_coords_in;
+      ag_base_coords = std::move(ag_base_coords_in);
       invalidate_stress();
     }
 
@@ -143,7 +144,7 @@ class AcOptimization {
         ac_error("sr_base_coords rows (%i) does not match input rows (%i)", sr_base_coords.n_rows, sr_base_coords_in.n_rows);
       }
       // Update coords
-      sr_base_coords = sr_base_coords_in;
+      sr_base_coords = std::move(sr_base_coords_in);
       invalidate_stress();
     }
 
@@ -311,17 +312,24 @@ class AcOptimization {
 
     // Align to another optimization
     void alignToOptimization(
-      AcOptimization target
+      const AcOptimization &target
     ){
 
-        // Get coordinates
-        arma::mat source_coords = ptBaseCoords();
-        arma::mat target_coords = target.ptBaseCoords();
+        alignToProcrustesTarget(
+          ac_procrustes_target(target.ptBaseCoords())
+        );
+
+    }
+
+    // Align to prepared procrustes target coordinates
+    void alignToProcrustesTarget(
+      const ProcrustesTarget &target
+    ){
 
         // Perform procrustes
-        Procrustes pc = ac_procrustes(
-          source_coords,
-          target_coords
+        Procrustes pc = ac_procrustes_to_target(
+          ptBaseCoords(),
+          target
         );
 
         // Set transformation
@@ -390,15 +398,14 @@ class AcOptimization {
 
     // Randomise coordinates
     void randomizeCoords(
-      double boxsize
+      double boxsize,
+      AcRNG &rng
     ){
 
       double min = -boxsize/2.0;
       double max = boxsize/2.0;
-      ag_base_coords.randu();
-      sr_base_coords.randu();
-      ag_base_coords = ag_base_coords*(max-min) + min;
-      sr_base_coords = sr_base_coords*(max-min) + min;
+      ag_base_coords.imbue( [&]() { return rng.runif(min, max); } );
+      sr_base_coords.imbue( [&]() { return rng.runif(min, max); } );
       invalidate_stress();
 
     }
@@ -418,24 +425,30 @@ class AcOptimization {
 
     }
 
-    // Relax the optimization
-    void relax_from_raw_matrices(
+    // Relax the optimization, returning true if the run was abandoned when
+    // racing against other runs
+    bool relax_from_raw_matrices(
       const arma::mat &tabledist_matrix,
       const arma::umat &titertype_matrix,
       const AcOptimizerOptions options,
       const arma::uvec &fixed_antigens = arma::uvec(),
-      const arma::uvec &fixed_sera = arma::uvec()
+      const arma::uvec &fixed_sera = arma::uvec(),
+      AcOptimizerRace *race = nullptr
     ){
 
-      stress = ac_relax_coords(
+      bool pruned = false;
+      stress = ac_relax_coords_with_race(
         tabledist_matrix,
         titertype_matrix,
         ag_base_coords,
         sr_base_coords,
         options,
         fixed_antigens,
-        fixed_sera
+        fixed_sera,
+        race,
+        &pruned
       );
+      return pruned;
 
     }
 
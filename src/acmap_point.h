@@ -51,8 +51,8 @@ class AcPoint {
     void set_group( int value ){ group = value; }
     void set_sequence( std::string value ){ sequence = value; }
 
-    // Get IDs for matching
-    std::string get_match_id() const {
+    // Get IDs for matching, returned by reference so they are not copied
+    const std::string& get_match_id() const {
       if(id == ""){
         return name;
       } else {
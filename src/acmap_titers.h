@@ -1,5 +1,8 @@
 
 #include <RcppArmadillo.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 
 #ifndef Racmacs__acmap_titers__h
 #define Racmacs__acmap_titers__h
@@ -112,6 +115,54 @@ class AcTiter {
 };
 
 
+// Parse a titer string without allocating, giving the same result as the
+// AcTiter string constructor. Returns false for strings that constructor
+// would reject, e.g. empty strings, which should then be passed to it so the
+// usual error is raised.
+inline bool parse_titer(
+    const char* titer,
+    AcTiter& out
+){
+
+  int type = 1;
+  switch(titer[0]){
+    case '\0':
+      return false;
+    case '*':
+      out = AcTiter(arma::datum::nan, 0);
+      return true;
+    case '<':
+      type = 2;
+      titer++;
+      break;
+    case '>':
+      type = 3;
+      titer++;
+      break;
+  }
+
+  // Plain integer titers like "40" are converted directly
+  double numeric = 0;
+  const char* c = titer;
+  while(*c >= '0' && *c <= '9' && c - titer < 15){
+    numeric = numeric*10 + (*c - '0');
+    c++;
+  }
+
+  // Anything else is converted with strtod, as std::stod would
+  if(c == titer || *c != '\0'){
+    char* end;
+    errno = 0;
+    numeric = std::strtod(titer, &end);
+    if(end == titer || errno == ERANGE) return false;
+  }
+
+  out = AcTiter(numeric, type);
+  return true;
+
+}
+
+
 // Define the titertable class
 class AcTiterTable {
 
@@ -123,7 +174,149 @@ class AcTiterTable {
     // 2 = measured lessthan e.g. "<10"
     // 3 = measured morethan e.g. ">1280"
     arma::mat numeric_titers;
-    arma::umat titer_types;
+    arma::Mat<unsigned char> titer_types;
+
+    // Optionally the table can be held in a compact form, for sparse tables
+    // like the layers of merged maps. Only measured titers are then stored, in
+    // compressed sparse column order, along with the numeric value shared by
+    // most unmeasured titers. Unmeasured titers with any other numeric value
+    // are also stored so the table reads back exactly as it was.
+    bool is_compact = false;
+    arma::uword compact_nags = 0;
+    arma::uword compact_nsr = 0;
+    double compact_unmeasured_numeric = 0;
+    std::vector<arma::uword> compact_col_ptrs;
+    std::vector<arma::uword> compact_row_indices;
+    std::vector<double> compact_numeric_titers;
+    std::vector<unsigned char> compact_titer_types;
+
+    // Find the position of a titer in the compact storage, returns -1 if the
+    // titer is not stored
+    arma::sword compact_index(
+        arma::uword agnum,
+        arma::uword srnum
+    ) const {
+
+      auto begin = compact_row_indices.begin() + compact_col_ptrs[srnum];
+      auto end = compact_row_indices.begin() + compact_col_ptrs[srnum + 1];
+      auto found = std::lower_bound(begin, end, agnum);
+      if(found == end || *found != agnum) return -1;
+      return found - compact_row_indices.begin();
+
+    }
+
+    // Check if an unmeasured numeric titer matches the compact default
+    bool compact_default_numeric(
+        double numeric
+    ) const {
+      if(std::isnan(compact_unmeasured_numeric)) return std::isnan(numeric);
+      return numeric == compact_unmeasured_numeric;
+    }
+
+    // Check if a serum of a compact table has titers that are not stored
+    bool compact_has_default(
+        arma::uword srnum
+    ) const {
+      return compact_col_ptrs[srnum + 1] - compact_col_ptrs[srnum] < compact_nags;
+    }
+
+    // Calculate the maximum log titer of each serum of a compact table by
+    // iterating over the stored titers, nan log titers count as the minimum
+    // log titer of the table, as in colbases_from_log_titers()
+    arma::vec compact_max_log_titers() const {
+
+      double default_logtiter = std::log2(compact_unmeasured_numeric / 10.0);
+
+      // Find the minimum log titer
+      double min_logtiter = arma::datum::inf;
+      if(compact_row_indices.size() < compact_nags*compact_nsr && default_logtiter < min_logtiter){
+        min_logtiter = default_logtiter;
+      }
+      for(auto &numeric : compact_numeric_titers){
+        double logtiter = std::log2(numeric / 10.0);
+        if(logtiter < min_logtiter) min_logtiter = logtiter;
+      }
+
+      // Find the maximum for each serum
+      arma::vec max_logtiters(compact_nsr);
+      for(arma::uword sr=0; sr<compact_nsr; sr++){
+        double max_logtiter = -arma::datum::inf;
+        if(compact_has_default(sr)){
+          max_logtiter = std::isnan(default_logtiter) ? min_logtiter : default_logtiter;
+        }
+        for(arma::uword i=compact_col_ptrs[sr]; i<compact_col_ptrs[sr + 1]; i++){
+          double logtiter = std::log2(compact_numeric_titers[i] / 10.0);
+          if(std::isnan(logtiter)) logtiter = min_logtiter;
+          if(logtiter > max_logtiter) max_logtiter = logtiter;
+        }
+        max_logtiters(sr) = max_logtiter;
+      }
+      return max_logtiters;
+
+    }
+
+    // Calculate table distances of a compact table by iterating over the
+    // stored titers, as in table_distances_from_log_titers()
+    arma::mat compact_table_distances(
+        const arma::vec &colbases
+    ) const {
+
+      double default_logtiter = std::log2(compact_unmeasured_numeric / 10.0);
+      arma::mat dists(compact_nags, compact_nsr);
+      dists.fill(arma::datum::nan);
+
+      // Set distances of measured titers, finding the maximum distance
+      double max_dist = -arma::datum::inf;
+      for(arma::uword sr=0; sr<compact_nsr; sr++){
+        if(compact_has_default(sr)){
+          double dist = colbases(sr) - default_logtiter;
+          if(dist > max_dist) max_dist = dist;
+        }
+        for(arma::uword i=compact_col_ptrs[sr]; i<compact_col_ptrs[sr + 1]; i++){
+          double dist = colbases(sr) - std::log2(compact_numeric_titers[i] / 10.0);
+          if(dist > max_dist) max_dist = dist;
+          if(compact_titer_types[i] != 0) dists(compact_row_indices[i], sr) = dist;
+        }
+      }
+
+      // Do not allow distances < 0
+      if(std::isfinite(max_dist)){
+        dists.transform( [](double dist){ return dist < 0 ? 0.0 : dist; } );
+      }
+
+      return dists;
+
+    }
+
+    // Apply minimum and fixed column bases
+    arma::vec limit_colbases(
+        arma::vec colbases,
+        const std::string &min_colbasis,
+        const arma::vec &fixed_colbases
+    ) const {
+
+      // Apply any minimum column bases
+      if(min_colbasis != "none"){
+        colbases = arma::clamp(
+          colbases,
+          AcTiter(min_colbasis).logTiter(),
+          colbases.max()
+        );
+      }
+
+      // Apply any fixed column bases
+      if(fixed_colbases.size() > 0){
+        if(fixed_colbases.size() != colbases.n_elem){
+          Rcpp::stop("Length of fixed column bases does not match the length of the column bases");
+        }
+        arma::uvec nonan = arma::find_finite(fixed_colbases);
+        colbases.elem( nonan ) = fixed_colbases.elem( nonan );
+      }
+
+      // Return the column bases
+      return colbases;
+
+    }
 
   public:
 
@@ -136,16 +329,121 @@ class AcTiterTable {
       titer_types(nags, nsr, arma::fill::zeros){};
 
     // Get dimensions
-    arma::uword nags() const { return numeric_titers.n_rows; }
-    arma::uword nsr() const { return numeric_titers.n_cols; }
-    arma::SizeMat size() const { return arma::size(numeric_titers); }
+    arma::uword nags() const { return is_compact ? compact_nags : numeric_titers.n_rows; }
+    arma::uword nsr() const { return is_compact ? compact_nsr : numeric_titers.n_cols; }
+    arma::SizeMat size() const { return arma::SizeMat(nags(), nsr()); }
+
+    // Convert to the compact form if no more than max_density of titers need
+    // to be stored, returns whether the table is now compact
+    bool compact(
+        double max_density = 0.25
+    ){
+
+      if(is_compact) return true;
+
+      // Use the most common unmeasured numeric value as the default
+      arma::uword num_unmeasured_nan = 0;
+      arma::uword num_unmeasured_zero = 0;
+      for(arma::uword i=0; i<titer_types.n_elem; i++){
+        if(titer_types(i) == 0){
+          if(std::isnan(numeric_titers(i))) num_unmeasured_nan++;
+          else if(numeric_titers(i) == 0) num_unmeasured_zero++;
+        }
+      }
+      compact_unmeasured_numeric = num_unmeasured_nan > num_unmeasured_zero ? arma::datum::nan : 0;
+
+      // Count the titers that would need to be stored
+      arma::uword num_stored = 0;
+      for(arma::uword i=0; i<titer_types.n_elem; i++){
+        if(titer_types(i) != 0 || !compact_default_numeric(numeric_titers(i))) num_stored++;
+      }
+      if(num_stored > max_density*titer_types.n_elem) return false;
+
+      // Store the titers
+      compact_nags = numeric_titers.n_rows;
+      compact_nsr = numeric_titers.n_cols;
+      compact_col_ptrs.assign(compact_nsr + 1, 0);
+      compact_row_indices.reserve(num_stored);
+      compact_numeric_titers.reserve(num_stored);
+      compact_titer_types.reserve(num_stored);
+
+      for(arma::uword sr=0; sr<compact_nsr; sr++){
+        for(arma::uword ag=0; ag<compact_nags; ag++){
+          if(titer_types(ag, sr) != 0 || !compact_default_numeric(numeric_titers(ag, sr))){
+            compact_row_indices.push_back(ag);
+            compact_numeric_titers.push_back(numeric_titers(ag, sr));
+            compact_titer_types.push_back(titer_types(ag, sr));
+          }
+        }
+        compact_col_ptrs[sr + 1] = compact_row_indices.size();
+      }
+
+      numeric_titers.reset();
+      titer_types.reset();
+      is_compact = true;
+      return true;
+
+    }
+
+    // Convert back from the compact form, tables are always expanded before
+    // they are modified
+    void expand(){
+
+      if(!is_compact) return;
+      numeric_titers = get_numeric_titers();
+      titer_types.set_size(compact_nags, compact_nsr);
+      titer_types.zeros();
+      for(arma::uword sr=0; sr<compact_nsr; sr++){
+        for(arma::uword i=compact_col_ptrs[sr]; i<compact_col_ptrs[sr + 1]; i++){
+          titer_types(compact_row_indices[i], sr) = compact_titer_types[i];
+        }
+      }
+
+      is_compact = false;
+      std::vector<arma::uword>().swap(compact_col_ptrs);
+      std::vector<arma::uword>().swap(compact_row_indices);
+      std::vector<double>().swap(compact_numeric_titers);
+      std::vector<unsigned char>().swap(compact_titer_types);
+
+    }
 
     // Get and set numeric_titers and titer types
-    arma::mat get_numeric_titers() const { return numeric_titers; }
-    void set_numeric_titers(arma::mat numeric_titers_in){ numeric_titers = numeric_titers_in; }
+    arma::mat get_numeric_titers() const {
+
+      if(!is_compact) return numeric_titers;
+      arma::mat out(compact_nags, compact_nsr);
+      out.fill(compact_unmeasured_numeric);
+      for(arma::uword sr=0; sr<compact_nsr; sr++){
+        for(arma::uword i=compact_col_ptrs[sr]; i<compact_col_ptrs[sr + 1]; i++){
+          out(compact_row_indices[i], sr) = compact_numeric_titers[i];
+        }
+      }
+      return out;
 
-    arma::umat get_titer_types() const { return titer_types; }
-    void set_titer_types(arma::umat titer_types_in){ titer_types = titer_types_in; }
+    }
+
+    void set_numeric_titers(arma::mat numeric_titers_in){
+      expand();
+      numeric_titers = numeric_titers_in;
+    }
+
+    arma::umat get_titer_types() const {
+
+      if(!is_compact) return arma::conv_to<arma::umat>::from(titer_types);
+      arma::umat out(compact_nags, compact_nsr, arma::fill::zeros);
+      for(arma::uword sr=0; sr<compact_nsr; sr++){
+        for(arma::uword i=compact_col_ptrs[sr]; i<compact_col_ptrs[sr + 1]; i++){
+          out(compact_row_indices[i], sr) = compact_titer_types[i];
+        }
+      }
+      return out;
+
+    }
+
+    void set_titer_types(arma::umat titer_types_in){
+      expand();
+      titer_types = arma::conv_to< arma::Mat<unsigned char> >::from(titer_types_in);
+    }
 
     // Get a given titer
     AcTiter get_titer(
@@ -153,6 +451,12 @@ class AcTiterTable {
         int srnum
     ) const {
 
+      if(is_compact){
+        arma::sword i = compact_index(agnum, srnum);
+        if(i == -1) return AcTiter(compact_unmeasured_numeric, 0);
+        return AcTiter(compact_numeric_titers[i], compact_titer_types[i]);
+      }
+
       return AcTiter(
         numeric_titers(agnum, srnum),
         titer_types(agnum, srnum)
@@ -173,11 +477,44 @@ class AcTiterTable {
       }
 
       // Set the titer
+      expand();
       numeric_titers(agnum, srnum) = titer.numeric;
       titer_types(agnum, srnum) = titer.type;
 
     }
 
+    // Set a titer without bounds checking or expanding a compact table, for
+    // filling newly constructed tables in bulk
+    void set_titer_unchecked(
+        arma::uword agnum,
+        arma::uword srnum,
+        const AcTiter& titer
+    ){
+      numeric_titers.at(agnum, srnum) = titer.numeric;
+      titer_types.at(agnum, srnum) = titer.type;
+    }
+
+    // Copy the numeric titers and titer types of a serum into raw arrays
+    void get_serum_titers(
+        arma::uword srnum,
+        double* numeric,
+        unsigned char* types
+    ) const {
+
+      if(is_compact){
+        std::fill(numeric, numeric + compact_nags, compact_unmeasured_numeric);
+        std::fill(types, types + compact_nags, 0);
+        for(arma::uword i=compact_col_ptrs[srnum]; i<compact_col_ptrs[srnum + 1]; i++){
+          numeric[compact_row_indices[i]] = compact_numeric_titers[i];
+          types[compact_row_indices[i]] = compact_titer_types[i];
+        }
+      } else {
+        std::copy(numeric_titers.colptr(srnum), numeric_titers.colptr(srnum) + numeric_titers.n_rows, numeric);
+        std::copy(titer_types.colptr(srnum), titer_types.colptr(srnum) + titer_types.n_rows, types);
+      }
+
+    }
+
     // Getting and setting by string
     std::string get_titer_string(
       arma::uword agnum,
@@ -195,7 +532,8 @@ class AcTiterTable {
       std::string titerstring
     ){
 
-      AcTiter titer = AcTiter(titerstring);
+      AcTiter titer;
+      if(!parse_titer(titerstring.c_str(), titer)) titer = AcTiter(titerstring);
       set_titer(agnum, srnum, titer);
 
     }
@@ -241,6 +579,7 @@ class AcTiterTable {
     void remove_antigen(
       arma::uword agnum
     ){
+      expand();
       numeric_titers.shed_row(agnum);
       titer_types.shed_row(agnum);
     }
@@ -249,6 +588,7 @@ class AcTiterTable {
     void remove_serum(
       arma::uword srnum
     ){
+      expand();
       numeric_titers.shed_col(srnum);
       titer_types.shed_col(srnum);
     }
@@ -258,6 +598,7 @@ class AcTiterTable {
       arma::uvec ags
     ){
 
+      expand();
       numeric_titers = numeric_titers.rows(ags);
       titer_types = titer_types.rows(ags);
 
@@ -267,6 +608,7 @@ class AcTiterTable {
         arma::uvec sr
     ){
 
+      expand();
       numeric_titers = numeric_titers.cols(sr);
       titer_types = titer_types.cols(sr);
 
@@ -277,6 +619,7 @@ class AcTiterTable {
         arma::uvec sr
     ){
 
+      expand();
       numeric_titers = numeric_titers.submat(ags, sr);
       titer_types = titer_types.submat(ags, sr);
 
@@ -285,19 +628,43 @@ class AcTiterTable {
     // Counting titers
     int num_measured(
     ) const {
+      if(is_compact) return std::count(compact_titer_types.begin(), compact_titer_types.end(), 1);
       return arma::accu(titer_types == 1);
     }
 
     int num_unmeasured(
     ) const {
+      if(is_compact){
+        return compact_nags*compact_nsr - compact_titer_types.size() +
+          std::count(compact_titer_types.begin(), compact_titer_types.end(), 0);
+      }
       return arma::accu(titer_types == 0);
     }
 
+    // Check if any titers are measured
+    bool any_measured(
+    ) const {
+      if(is_compact){
+        return std::any_of(
+          compact_titer_types.begin(), compact_titer_types.end(),
+          [](unsigned char type){ return type != 0; }
+        );
+      }
+      return std::any_of(
+        titer_types.begin(), titer_types.end(),
+        [](unsigned char type){ return type != 0; }
+      );
+    }
+
     // Check if a titer is measured
     bool titer_measured(
       const int& ag,
       const int& sr
     ) const {
+      if(is_compact){
+        arma::sword i = compact_index(ag, sr);
+        return i != -1 && compact_titer_types[i] != 0;
+      }
       return titer_types(ag, sr) != 0;
     }
 
@@ -305,6 +672,7 @@ class AcTiterTable {
     void set_unmeasured(
         arma::uvec indices
     ){
+      expand();
       titer_types.elem(indices).zeros();
       numeric_titers.elem(indices).zeros();
     }
@@ -313,6 +681,18 @@ class AcTiterTable {
     arma::uvec vec_indices_measured(
     ) const {
 
+      if(is_compact){
+        std::vector<arma::uword> indices;
+        for(arma::uword sr=0; sr<compact_nsr; sr++){
+          for(arma::uword i=compact_col_ptrs[sr]; i<compact_col_ptrs[sr + 1]; i++){
+            if(compact_titer_types[i] != 0){
+              indices.push_back(compact_row_indices[i] + sr*compact_nags);
+            }
+          }
+        }
+        return arma::uvec(indices);
+      }
+
       int n_measured = arma::accu(titer_types != 0);
       arma::uvec indices(n_measured);
 
@@ -328,41 +708,49 @@ class AcTiterTable {
 
     }
 
+    // Get the log titers of the table
+    arma::mat log_titers() const {
+      if(is_compact) return arma::log2(get_numeric_titers() / 10.0);
+      return arma::log2(numeric_titers / 10.0);
+    }
+
     // Calculate column bases
     arma::vec colbases(
         std::string min_colbasis,
         arma::vec fixed_colbases
     ) const {
 
-      // Check input
-      if(fixed_colbases.n_elem != nsr()) Rf_error("fixed_colbases does not match number of sera");
-      if(arma::accu(titer_types) == 0) return fixed_colbases;
+      // Compact tables are read without expanding them
+      if(is_compact){
+        if(fixed_colbases.n_elem != nsr()) Rf_error("fixed_colbases does not match number of sera");
+        if(!any_measured()) return fixed_colbases;
+        return limit_colbases(compact_max_log_titers(), min_colbasis, fixed_colbases);
+      }
 
-      // Calculate column bases
-      arma::mat log_titers = arma::log2(numeric_titers / 10.0);
-      log_titers.replace(arma::datum::nan, log_titers.min());
-      arma::vec colbases = arma::max(log_titers.t(), 1);
+      return colbases_from_log_titers(
+        log_titers(),
+        min_colbasis,
+        fixed_colbases
+      );
 
-      // Apply any minimum column bases
-      if(min_colbasis != "none"){
-        colbases = arma::clamp(
-          colbases,
-          AcTiter(min_colbasis).logTiter(),
-          colbases.max()
-        );
-      }
+    }
 
-      // Apply any fixed column bases
-      if(fixed_colbases.size() > 0){
-        if(fixed_colbases.size() != colbases.n_elem){
-          Rcpp::stop("Length of fixed column bases does not match the length of the column bases");
-        }
-        arma::uvec nonan = arma::find_finite(fixed_colbases);
-        colbases.elem( nonan ) = fixed_colbases.elem( nonan );
-      }
+    // Calculate column bases from a matrix of log titers matching the titer
+    // types of the table, e.g. log titers with noise added
+    arma::vec colbases_from_log_titers(
+        arma::mat logtiters,
+        std::string min_colbasis,
+        arma::vec fixed_colbases
+    ) const {
 
-      // Return the column bases
-      return colbases;
+      // Check input
+      if(fixed_colbases.n_elem != nsr()) Rf_error("fixed_colbases does not match number of sera");
+      if(!any_measured()) return fixed_colbases;
+
+      // Calculate column bases
+      logtiters.replace(arma::datum::nan, logtiters.min());
+      arma::vec colbases = arma::max(logtiters.t(), 1);
+      return limit_colbases(colbases, min_colbasis, fixed_colbases);
 
     }
 
@@ -371,8 +759,23 @@ class AcTiterTable {
       arma::vec colbases
     ) const {
 
+      if(is_compact) return compact_table_distances(colbases);
+      return table_distances_from_log_titers(
+        log_titers(),
+        colbases
+      );
+
+    }
+
+    // Calculate table distances from a matrix of log titers matching the
+    // titer types of the table
+    arma::mat table_distances_from_log_titers(
+      const arma::mat &logtiters,
+      const arma::vec &colbases
+    ) const {
+
       // Set distances as log titers
-      arma::mat dists = arma::log2(numeric_titers / 10.0);
+      arma::mat dists = logtiters;
 
       // Subtract colbases from each log titer row to arrive at distance
       for(arma::uword i=0; i<dists.n_rows; i++){
@@ -385,7 +788,8 @@ class AcTiterTable {
       }
 
       // Replace na titers with na dists
-      dists.elem( arma::find(titer_types == 0) ).fill( arma::datum::nan );
+      if(is_compact) dists.elem( arma::find(get_titer_types() == 0) ).fill( arma::datum::nan );
+      else           dists.elem( arma::find(titer_types == 0) ).fill( arma::datum::nan );
 
       // Return distance matrix
       return dists;
@@ -397,6 +801,7 @@ class AcTiterTable {
       arma::mat log_titers_to_add
     ){
 
+      expand();
       arma::mat logtiters = arma::log2(numeric_titers / 10.0);
       logtiters += log_titers_to_add;
       numeric_titers = arma::exp2(logtiters)*10.0;
@@ -0,0 +1,236 @@
+
+#include <RcppArmadillo.h>
+#include "acmap_map.h"
+#include "acmap_point.h"
+#include "acmap_optimization.h"
+#include "acmap_binary.h"
+
+// Set point details from the columns of point metadata
+void set_point_from_binary(
+    AcPoint &pt,
+    const arma::uword &i,
+    const std::vector<std::string> &strings,
+    const std::vector< std::vector<uint32_t> > &string_cols,
+    const std::vector<uint8_t> &references,
+    const std::vector<int32_t> &groups,
+    const std::vector<uint8_t> &shown,
+    const std::vector< std::vector<double> > &double_cols
+){
+
+  // Look up a string index, checking it is in range
+  auto str = [&](const std::vector<uint32_t> &col) -> const std::string& {
+    if(col[i] >= strings.size()) Rcpp::stop("Binary map file is truncated or corrupt");
+    return strings[col[i]];
+  };
+
+  pt.set_name( str(string_cols[0]) );
+  pt.set_date( str(string_cols[1]) );
+  pt.set_passage( str(string_cols[2]) );
+  pt.set_name_full( str(string_cols[3]) );
+  pt.set_name_abbreviated( str(string_cols[4]) );
+  pt.set_id( str(string_cols[5]) );
+  pt.set_sequence( str(string_cols[6]) );
+  pt.set_reference( references[i] );
+  pt.set_group( groups[i] );
+  pt.plotspec.set_shown( shown[i] );
+  pt.plotspec.set_fill( str(string_cols[7]) );
+  pt.plotspec.set_outline( str(string_cols[8]) );
+  pt.plotspec.set_shape( str(string_cols[9]) );
+  pt.plotspec.set_outline_width( double_cols[0][i] );
+  pt.plotspec.set_size( double_cols[1][i] );
+  pt.plotspec.set_rotation( double_cols[2][i] );
+  pt.plotspec.set_aspect( double_cols[3][i] );
+
+}
+
+
+// Read a titer table of numeric titers and titer types
+void read_titer_table(
+    AcBinaryReader &reader,
+    AcTiterTable &titer_table,
+    const arma::uword &num_antigens,
+    const arma::uword &num_sera
+){
+
+  titer_table.set_numeric_titers( reader.read_mat(num_antigens, num_sera) );
+  std::vector<uint8_t> types = reader.read_array<uint8_t>(num_antigens*num_sera);
+  arma::umat titer_types(num_antigens, num_sera);
+  std::copy(types.begin(), types.end(), titer_types.begin());
+  titer_table.set_titer_types( titer_types );
+
+}
+
+
+// Look up strings from a column of string indices
+std::vector<std::string> strings_from_binary(
+    const std::vector<uint32_t> &indices,
+    const std::vector<std::string> &strings
+){
+
+  std::vector<std::string> out(indices.size());
+  for(arma::uword i=0; i<indices.size(); i++){
+    if(indices[i] >= strings.size()) Rcpp::stop("Binary map file is truncated or corrupt");
+    out[i] = strings[indices[i]];
+  }
+  return out;
+
+}
+
+
+// Skip over the data of an optimization
+void skip_optimization(
+    AcBinaryReader &reader
+){
+
+  std::vector<uint64_t> sizes = reader.read_array<uint64_t>(7);
+  for(arma::uword i=0; i<5; i++) reader.skip_array<double>();
+  for(arma::uword i=0; i<sizes[6]; i++){
+    reader.skip_array<uint64_t>();
+    reader.skip_array<double>();
+    reader.skip_array<double>();
+  }
+
+}
+
+
+// Read the data of an optimization
+AcOptimization read_optimization(
+    AcBinaryReader &reader,
+    const arma::uword &num_antigens,
+    const arma::uword &num_sera
+){
+
+  std::vector<uint64_t> sizes = reader.read_array<uint64_t>(7);
+  AcOptimization optimization( sizes[0], num_antigens, num_sera );
+
+  optimization.set_fixed_column_bases( arma::vec(reader.read_array<double>(num_sera)), false );
+  optimization.set_transformation( reader.read_mat(sizes[2], sizes[3]) );
+  optimization.set_translation( reader.read_mat(sizes[4], sizes[5]) );
+  optimization.set_ag_base_coords( reader.read_mat(num_antigens, sizes[0]) );
+  optimization.set_sr_base_coords( reader.read_mat(num_sera, sizes[1]) );
+
+  // Bootstrap results
+  optimization.bootstrap.resize(sizes[6]);
+  for(auto &bootstrap : optimization.bootstrap){
+    std::vector<uint64_t> bootstrap_sizes = reader.read_array<uint64_t>(3);
+    bootstrap.ag_noise = reader.read_mat(bootstrap_sizes[0], 1);
+    bootstrap.coords = reader.read_mat(bootstrap_sizes[1], bootstrap_sizes[2]);
+  }
+
+  return optimization;
+
+}
+
+
+// Read an acmap from a binary file, optionally decoding only the optimization
+// runs requested
+// [[Rcpp::export]]
+AcMap binary_to_acmap(
+    std::string filepath,
+    Rcpp::Nullable<Rcpp::IntegerVector> optimization_numbers = R_NilValue
+){
+
+  AcBinaryReader reader(filepath);
+
+  // Check header
+  if(std::memcmp(reader.read(8), acmap_binary_magic, 8) != 0){
+    Rcpp::stop("File '" + filepath + "' is not a binary acmap file");
+  }
+
+  // The byte order is checked before the version, since the version cannot be
+  // read correctly from a file with a different byte order
+  uint32_t version = reader.read_value<uint32_t>();
+  uint32_t bom = reader.read_value<uint32_t>();
+  if(bom != acmap_binary_bom){
+    Rcpp::stop("Binary acmap file was written with a different byte order");
+  }
+  if(version != acmap_binary_version){
+    Rcpp::stop("Unsupported binary acmap file version");
+  }
+
+  uint64_t num_antigens = reader.read_value<uint64_t>();
+  uint64_t num_sera = reader.read_value<uint64_t>();
+  uint64_t num_layers = reader.read_value<uint64_t>();
+  uint64_t num_optimizations = reader.read_value<uint64_t>();
+  uint64_t num_strings = reader.read_value<uint64_t>();
+  uint64_t num_points = num_antigens + num_sera;
+
+  // String table
+  std::vector<std::string> strings = reader.read_string_table(num_strings);
+
+  // Setup map
+  AcMap map(num_antigens, num_sera);
+
+  // == INFO ============================
+  map.name = strings_from_binary( reader.read_array<uint32_t>(1), strings )[0];
+  map.set_ag_group_levels( strings_from_binary( reader.read_array<uint32_t>(), strings ) );
+  map.set_sr_group_levels( strings_from_binary( reader.read_array<uint32_t>(), strings ) );
+
+  // == POINTS ==========================
+  std::vector< std::vector<uint32_t> > string_cols(10);
+  for(arma::uword i=0; i<7; i++) string_cols[i] = reader.read_array<uint32_t>(num_points);
+  std::vector<uint8_t> references = reader.read_array<uint8_t>(num_points);
+  std::vector<int32_t> groups = reader.read_array<int32_t>(num_points);
+  std::vector<uint8_t> shown = reader.read_array<uint8_t>(num_points);
+  for(arma::uword i=7; i<10; i++) string_cols[i] = reader.read_array<uint32_t>(num_points);
+  std::vector< std::vector<double> > double_cols(4);
+  for(arma::uword i=0; i<4; i++) double_cols[i] = reader.read_array<double>(num_points);
+
+  for(arma::uword i=0; i<num_antigens; i++){
+    set_point_from_binary(
+      map.antigens[i], i, strings,
+      string_cols, references, groups, shown, double_cols
+    );
+  }
+
+  for(arma::uword i=0; i<num_sera; i++){
+    set_point_from_binary(
+      map.sera[i], i + num_antigens, strings,
+      string_cols, references, groups, shown, double_cols
+    );
+  }
+
+  std::vector<uint64_t> drawing_order = reader.read_array<uint64_t>(num_points);
+  map.set_pt_drawing_order( arma::conv_to<arma::uvec>::from(drawing_order) );
+
+  // == TITERS ==========================
+  read_titer_table(reader, map.titer_table_flat, num_antigens, num_sera);
+  map.titer_table_layers.resize(num_layers, AcTiterTable(num_antigens, num_sera));
+  for(auto &titer_table_layer : map.titer_table_layers){
+    read_titer_table(reader, titer_table_layer, num_antigens, num_sera);
+  }
+
+  // == OPTIMIZATIONS ===================
+  std::vector<uint32_t> opt_comments = reader.read_array<uint32_t>(num_optimizations);
+  std::vector<uint32_t> opt_min_colbases = reader.read_array<uint32_t>(num_optimizations);
+  std::vector<double> opt_stresses = reader.read_array<double>(num_optimizations);
+  std::vector<std::string> comments = strings_from_binary(opt_comments, strings);
+  std::vector<std::string> min_colbases = strings_from_binary(opt_min_colbases, strings);
+
+  // Index where each optimization is stored, skipping over the data, then
+  // decode only the optimizations requested
+  arma::uvec opt_indices = optimization_indices(optimization_numbers, num_optimizations);
+  std::vector<uint64_t> opt_offsets(num_optimizations);
+  for(arma::uword i=0; i<num_optimizations; i++){
+    opt_offsets[i] = reader.tell();
+    skip_optimization(reader);
+  }
+
+  map.optimizations.reserve(opt_indices.n_elem);
+  for(arma::uword i=0; i<opt_indices.n_elem; i++){
+
+    arma::uword optnum = opt_indices(i);
+    reader.seek(opt_offsets[optnum]);
+    AcOptimization optimization = read_optimization(reader, num_antigens, num_sera);
+    optimization.set_comment( comments[optnum] );
+    optimization.set_min_column_basis( min_colbases[optnum], false );
+
+    // Set stress last since setting coordinates invalidates it
+    optimization.set_stress( opt_stresses[optnum] );
+    map.optimizations.push_back( std::move(optimization) );
+
+  }
+
+  return map;
+
+}
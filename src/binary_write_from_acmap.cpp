@@ -0,0 +1,203 @@
+
+#include <RcppArmadillo.h>
+#include "acmap_map.h"
+#include "acmap_point.h"
+#include "acmap_optimization.h"
+#include "acmap_binary.h"
+
+// Columns of point metadata, with strings held as string table indices
+struct AcBinaryPointColumns {
+
+  std::vector<uint32_t> names;
+  std::vector<uint32_t> dates;
+  std::vector<uint32_t> passages;
+  std::vector<uint32_t> names_full;
+  std::vector<uint32_t> names_abbreviated;
+  std::vector<uint32_t> ids;
+  std::vector<uint32_t> sequences;
+  std::vector<uint8_t> references;
+  std::vector<int32_t> groups;
+  std::vector<uint8_t> shown;
+  std::vector<uint32_t> fills;
+  std::vector<uint32_t> outlines;
+  std::vector<uint32_t> shapes;
+  std::vector<double> outline_widths;
+  std::vector<double> sizes;
+  std::vector<double> rotations;
+  std::vector<double> aspects;
+
+  void add_point(
+      const AcPoint &pt,
+      AcBinaryStringTable &strings
+  ){
+    names.push_back( strings.index(pt.get_name()) );
+    dates.push_back( strings.index(pt.get_date()) );
+    passages.push_back( strings.index(pt.get_passage()) );
+    names_full.push_back( strings.index(pt.get_name_full()) );
+    names_abbreviated.push_back( strings.index(pt.get_name_abbreviated()) );
+    ids.push_back( strings.index(pt.get_id()) );
+    sequences.push_back( strings.index(pt.get_sequence()) );
+    references.push_back( pt.get_reference() );
+    groups.push_back( pt.get_group() );
+    shown.push_back( pt.plotspec.get_shown() );
+    fills.push_back( strings.index(pt.plotspec.get_fill()) );
+    outlines.push_back( strings.index(pt.plotspec.get_outline()) );
+    shapes.push_back( strings.index(pt.plotspec.get_shape()) );
+    outline_widths.push_back( pt.plotspec.get_outline_width() );
+    sizes.push_back( pt.plotspec.get_size() );
+    rotations.push_back( pt.plotspec.get_rotation() );
+    aspects.push_back( pt.plotspec.get_aspect() );
+  }
+
+  void write(
+      AcBinaryWriter &writer
+  ) const {
+    writer.write_array(names);
+    writer.write_array(dates);
+    writer.write_array(passages);
+    writer.write_array(names_full);
+    writer.write_array(names_abbreviated);
+    writer.write_array(ids);
+    writer.write_array(sequences);
+    writer.write_array(references);
+    writer.write_array(groups);
+    writer.write_array(shown);
+    writer.write_array(fills);
+    writer.write_array(outlines);
+    writer.write_array(shapes);
+    writer.write_array(outline_widths);
+    writer.write_array(sizes);
+    writer.write_array(rotations);
+    writer.write_array(aspects);
+  }
+
+};
+
+
+// Write a titer table as numeric titers and titer types
+void write_titer_table(
+    AcBinaryWriter &writer,
+    const AcTiterTable &titer_table
+){
+
+  arma::umat titer_types = titer_table.get_titer_types();
+  std::vector<uint8_t> types(titer_types.begin(), titer_types.end());
+  writer.write_array( titer_table.get_numeric_titers() );
+  writer.write_array( types );
+
+}
+
+
+// [[Rcpp::export]]
+void acmap_to_binary(
+    AcMap map,
+    std::string filepath
+){
+
+  uint64_t num_antigens = map.antigens.size();
+  uint64_t num_sera = map.sera.size();
+  uint64_t num_layers = map.titer_table_layers.size();
+  uint64_t num_optimizations = map.optimizations.size();
+  AcBinaryStringTable strings;
+
+  // == INFO ============================
+  std::vector<uint32_t> info { strings.index(map.name) };
+  std::vector<uint32_t> ag_group_levels;
+  std::vector<uint32_t> sr_group_levels;
+  for(auto &level : map.get_ag_group_levels()) ag_group_levels.push_back( strings.index(level) );
+  for(auto &level : map.get_sr_group_levels()) sr_group_levels.push_back( strings.index(level) );
+
+  // == POINTS ==========================
+  AcBinaryPointColumns points;
+  for(auto &ag : map.antigens) points.add_point(ag, strings);
+  for(auto &sr : map.sera) points.add_point(sr, strings);
+
+  // == OPTIMIZATION DETAILS ============
+  std::vector<uint32_t> opt_comments;
+  std::vector<uint32_t> opt_min_colbases;
+  std::vector<double> opt_stresses;
+  for(auto &optimization : map.optimizations){
+    opt_comments.push_back( strings.index(optimization.get_comment()) );
+    opt_min_colbases.push_back( strings.index(optimization.get_min_column_basis()) );
+    opt_stresses.push_back( optimization.stress );
+  }
+
+  // == WRITE ===========================
+  AcBinaryWriter writer(filepath);
+
+  // Header
+  writer.write(acmap_binary_magic, 8);
+  writer.write_value(acmap_binary_version);
+  writer.write_value(acmap_binary_bom);
+  writer.write_value(num_antigens);
+  writer.write_value(num_sera);
+  writer.write_value(num_layers);
+  writer.write_value(num_optimizations);
+  writer.write_value<uint64_t>(strings.strings.size());
+
+  // String table
+  writer.write_string_table(strings);
+
+  // Info
+  writer.write_array(info);
+  writer.write_array(ag_group_levels);
+  writer.write_array(sr_group_levels);
+
+  // Points
+  points.write(writer);
+  arma::uvec drawing_order = map.get_pt_drawing_order();
+  std::vector<uint64_t> drawing_order_out(drawing_order.begin(), drawing_order.end());
+  writer.write_array(drawing_order_out);
+
+  // Titers
+  write_titer_table(writer, map.titer_table_flat);
+  for(auto &titer_table_layer : map.titer_table_layers){
+    write_titer_table(writer, titer_table_layer);
+  }
+
+  // Optimizations
+  writer.write_array(opt_comments);
+  writer.write_array(opt_min_colbases);
+  writer.write_array(opt_stresses);
+
+  for(auto &optimization : map.optimizations){
+
+    arma::mat ag_coords = optimization.get_ag_base_coords();
+    arma::mat sr_coords = optimization.get_sr_base_coords();
+    arma::mat transformation = optimization.get_transformation();
+    arma::mat translation = optimization.get_translation();
+
+    std::vector<uint64_t> sizes {
+      ag_coords.n_cols,
+      sr_coords.n_cols,
+      transformation.n_rows,
+      transformation.n_cols,
+      translation.n_rows,
+      translation.n_cols,
+      optimization.bootstrap.size()
+    };
+
+    writer.write_array(sizes);
+    writer.write_array(optimization.get_fixed_column_bases());
+    writer.write_array(transformation);
+    writer.write_array(translation);
+    writer.write_array(ag_coords);
+    writer.write_array(sr_coords);
+
+    // Bootstrap results
+    for(auto &bootstrap : optimization.bootstrap){
+      std::vector<uint64_t> bootstrap_sizes {
+        bootstrap.ag_noise.n_elem,
+        bootstrap.coords.n_rows,
+        bootstrap.coords.n_cols
+      };
+      writer.write_array(bootstrap_sizes);
+      writer.write_array(bootstrap.ag_noise);
+      writer.write_array(bootstrap.coords);
+    }
+
+  }
+
+  writer.close();
+
+}
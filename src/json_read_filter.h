@@ -0,0 +1,131 @@
+#include <string>
+#include <vector>
+
+// [[Rcpp::depends(rapidjsonr)]]
+#include <rapidjson/document.h>
+
+#ifndef Racmacs__json_read_filter__h
+#define Racmacs__json_read_filter__h
+
+// A SAX handler that passes parse events on to a document, replacing any
+// optimization runs that were not requested with null. Runs are stored in
+// "c" > "P" with any extra run data in "c" > "x" > "p", unwanted runs are
+// skipped as they are parsed so they are never built in the document, while
+// the null placeholders keep the index of each run the same.
+class AcJsonOptimizationFilter {
+
+  public:
+
+    typedef char Ch;
+
+    // Constructor
+    AcJsonOptimizationFilter(
+      rapidjson::Document &doc,
+      const std::vector<bool> &keep_runs
+    ):
+      doc_(doc),
+      keep_runs_(keep_runs),
+      skip_depth_(0)
+    {}
+
+    // Values
+    bool Null(){ return value([&]{ return doc_.Null(); }); }
+    bool Bool(bool b){ return value([&]{ return doc_.Bool(b); }); }
+    bool Int(int i){ return value([&]{ return doc_.Int(i); }); }
+    bool Uint(unsigned u){ return value([&]{ return doc_.Uint(u); }); }
+    bool Int64(int64_t i){ return value([&]{ return doc_.Int64(i); }); }
+    bool Uint64(uint64_t u){ return value([&]{ return doc_.Uint64(u); }); }
+    bool Double(double d){ return value([&]{ return doc_.Double(d); }); }
+    bool RawNumber(const Ch* str, rapidjson::SizeType length, bool copy){
+      return value([&]{ return doc_.RawNumber(str, length, copy); });
+    }
+    bool String(const Ch* str, rapidjson::SizeType length, bool copy){
+      return value([&]{ return doc_.String(str, length, copy); });
+    }
+
+    // Objects
+    bool StartObject(){
+      if(skip_depth_ > 0){ skip_depth_++; return true; }
+      if(skip_value()){ skip_depth_ = 1; return doc_.Null(); }
+      frames_.push_back(Frame{ false, std::string(), 0 });
+      return doc_.StartObject();
+    }
+
+    bool Key(const Ch* str, rapidjson::SizeType length, bool copy){
+      if(skip_depth_ > 0) return true;
+      frames_.back().key.assign(str, length);
+      return doc_.Key(str, length, copy);
+    }
+
+    bool EndObject(rapidjson::SizeType member_count){
+      if(skip_depth_ > 0){ skip_depth_--; return true; }
+      frames_.pop_back();
+      return doc_.EndObject(member_count);
+    }
+
+    // Arrays
+    bool StartArray(){
+      if(skip_depth_ > 0){ skip_depth_++; return true; }
+      if(skip_value()){ skip_depth_ = 1; return doc_.Null(); }
+      frames_.push_back(Frame{ true, std::string(), 0 });
+      return doc_.StartArray();
+    }
+
+    bool EndArray(rapidjson::SizeType element_count){
+      if(skip_depth_ > 0){ skip_depth_--; return true; }
+      frames_.pop_back();
+      return doc_.EndArray(element_count);
+    }
+
+  private:
+
+    // The key last seen in an object, or the next element index in an array
+    struct Frame {
+      bool is_array;
+      std::string key;
+      rapidjson::SizeType index;
+    };
+
+    rapidjson::Document &doc_;
+    const std::vector<bool> &keep_runs_;
+    std::vector<Frame> frames_;
+    int skip_depth_;
+
+    // Check whether a frame is an object entered through the given key
+    bool frame_is(
+      const std::size_t &i,
+      const char* key
+    ) const {
+      return !frames_[i].is_array && frames_[i].key == key;
+    }
+
+    // Check whether the innermost frame is an array of optimization runs
+    bool in_runs_array() const {
+      if(frames_.size() == 3){
+        return frame_is(0, "c") && frame_is(1, "P");
+      }
+      if(frames_.size() == 4){
+        return frame_is(0, "c") && frame_is(1, "x") && frame_is(2, "p");
+      }
+      return false;
+    }
+
+    // Called as each value starts, returns true if it should be skipped
+    bool skip_value(){
+      if(frames_.empty() || !frames_.back().is_array) return false;
+      rapidjson::SizeType index = frames_.back().index++;
+      if(!in_runs_array()) return false;
+      return index >= keep_runs_.size() || !keep_runs_[index];
+    }
+
+    // Pass on a scalar value, or null in place of a skipped run
+    template <typename F>
+    bool value(F pass_on){
+      if(skip_depth_ > 0) return true;
+      if(skip_value()) return doc_.Null();
+      return pass_on();
+    }
+
+};
+
+#endif
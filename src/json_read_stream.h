@@ -0,0 +1,181 @@
+
+#include <RcppArmadillo.h>
+#include <cstdio>
+#include <zlib.h>
+#include <lzma.h>
+
+// [[Rcpp::depends(rapidjsonr)]]
+#include <rapidjson/rapidjson.h>
+
+#ifndef Racmacs__json_read_stream__h
+#define Racmacs__json_read_stream__h
+
+// A rapidjson read stream that decompresses a file in chunks as it is parsed,
+// so the full json text is never held in memory. Files compressed with xz are
+// decompressed with liblzma, gzip compressed and uncompressed files are both
+// read through zlib. Modelled on rapidjson's FileReadStream.
+class AcJsonFileReadStream {
+
+  public:
+
+    typedef char Ch;
+
+    // Constructor
+    AcJsonFileReadStream(
+      const std::string &filepath
+    ):
+      buffer_(buffer_size + 1),
+      in_buffer_(buffer_size),
+      count_(0),
+      read_count_(0),
+      eof_(false),
+      failed_(false),
+      fp_(NULL),
+      gz_(NULL),
+      lzma_eof_(false)
+    {
+
+      lzma_stream lzma_init = LZMA_STREAM_INIT;
+      lzma_ = lzma_init;
+
+      // Check the file magic number for xz compression
+      fp_ = fopen(filepath.c_str(), "rb");
+      if(fp_ == NULL) Rcpp::stop("File '" + filepath + "' could not be opened");
+
+      unsigned char magic[6] = {0};
+      size_t nmagic = fread(magic, 1, 6, fp_);
+      const unsigned char xz_magic[6] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+
+      if(nmagic == 6 && std::equal(magic, magic + 6, xz_magic)){
+
+        // Setup xz decompression
+        rewind(fp_);
+        if(lzma_stream_decoder(&lzma_, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK){
+          fclose(fp_);
+          Rcpp::stop("Could not initialise xz decompression");
+        }
+
+      } else {
+
+        // Otherwise read through zlib
+        fclose(fp_);
+        fp_ = NULL;
+        gz_ = gzopen(filepath.c_str(), "rb");
+        if(gz_ == NULL) Rcpp::stop("File '" + filepath + "' could not be opened");
+        gzbuffer(gz_, buffer_size);
+
+      }
+
+      current_ = &buffer_[0];
+      last_ = &buffer_[0];
+      Read();
+
+    }
+
+    // Destructor
+    ~AcJsonFileReadStream(){
+      if(fp_ != NULL) fclose(fp_);
+      if(gz_ != NULL) gzclose(gz_);
+      lzma_end(&lzma_);
+    }
+
+    // Stream interface
+    Ch Peek() const { return *current_; }
+    Ch Take() { Ch c = *current_; Read(); return c; }
+    size_t Tell() const { return count_ + static_cast<size_t>(current_ - &buffer_[0]); }
+
+    // Not implemented
+    void Put(Ch) { RAPIDJSON_ASSERT(false); }
+    void Flush() { RAPIDJSON_ASSERT(false); }
+    Ch* PutBegin() { RAPIDJSON_ASSERT(false); return 0; }
+    size_t PutEnd(Ch*) { RAPIDJSON_ASSERT(false); return 0; }
+
+    // Check whether reading or decompressing the file failed
+    bool failed() const { return failed_; }
+
+  private:
+
+    static const size_t buffer_size = 65536;
+
+    std::vector<Ch> buffer_;
+    std::vector<uint8_t> in_buffer_;
+    Ch *current_;
+    Ch *last_;
+    size_t count_;
+    size_t read_count_;
+    bool eof_;
+    bool failed_;
+
+    FILE *fp_;
+    gzFile gz_;
+    lzma_stream lzma_;
+    bool lzma_eof_;
+
+    // Move to the next character, refilling the buffer when needed
+    void Read() {
+
+      if(current_ < last_){
+        ++current_;
+      } else if(!eof_){
+        count_ += read_count_;
+        read_count_ = Fill(&buffer_[0], buffer_size);
+        last_ = &buffer_[0] + read_count_ - 1;
+        current_ = &buffer_[0];
+
+        if(read_count_ < buffer_size){
+          buffer_[read_count_] = '\0';
+          ++last_;
+          eof_ = true;
+        }
+      }
+
+    }
+
+    // Fill a buffer with up to n decompressed characters
+    size_t Fill(
+        Ch *out,
+        size_t n
+    ){
+
+      // Read through zlib
+      if(gz_ != NULL){
+        int nread = gzread(gz_, out, static_cast<unsigned int>(n));
+        if(nread < 0){
+          failed_ = true;
+          return 0;
+        }
+        return static_cast<size_t>(nread);
+      }
+
+      // Decompress xz
+      lzma_.next_out = reinterpret_cast<uint8_t*>(out);
+      lzma_.avail_out = n;
+
+      while(lzma_.avail_out > 0){
+
+        if(lzma_.avail_in == 0 && !lzma_eof_){
+          lzma_.next_in = &in_buffer_[0];
+          lzma_.avail_in = fread(&in_buffer_[0], 1, in_buffer_.size(), fp_);
+          if(feof(fp_)) lzma_eof_ = true;
+          else if(ferror(fp_)){
+            failed_ = true;
+            break;
+          }
+        }
+
+        lzma_ret ret = lzma_code(&lzma_, lzma_eof_ ? LZMA_FINISH : LZMA_RUN);
+        if(ret == LZMA_STREAM_END) break;
+        if(ret != LZMA_OK){
+          failed_ = true;
+          break;
+        }
+
+      }
+
+      return n - lzma_.avail_out;
+
+    }
+
+};
+
+#endif
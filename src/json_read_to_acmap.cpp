@@ -1,5 +1,8 @@
 
 #include "json_read_to_acmap.h"
+#include "json_read_stream.h"
+#include "json_read_filter.h"
+#include "utils_parallel.h"
 
 // Function for setting point style
 template <typename T>
@@ -20,39 +23,61 @@ void set_style_from_json(
 }
 
 
-// Function for setting titers
+// Function for setting titers, rows are parsed in parallel straight into the
+// table and if anything unexpected is found the titers are set one by one
+// instead, so the usual errors are raised
 void set_titers_from_json(
   AcTiterTable& titer_table,
-  const Value& td
+  const Value& td,
+  const int &num_cores
 ){
 
-  for (SizeType ag = 0; ag < td.Size(); ag++){
-    for (auto& sr : td[ag].GetObject()){
-      titer_table.set_titer_string(
-        ag, strtoimax( sr.name.GetString(), NULL, 10 ),
-        sr.value.GetString()
-      );
+  const intmax_t num_sr = titer_table.nsr();
+  bool parsed = td.IsArray() && td.Size() <= titer_table.nags();
+
+  if(parsed){
+    #pragma omp parallel for schedule(dynamic, 64) num_threads(ac_num_threads(num_cores))
+    for (SizeType ag = 0; ag < td.Size(); ag++){
+      const Value& row = td[ag];
+      if(!row.IsObject()){
+        #pragma omp atomic write
+        parsed = false;
+        continue;
+      }
+      for (auto& sr : row.GetObject()){
+        intmax_t srnum = strtoimax( sr.name.GetString(), NULL, 10 );
+        AcTiter titer;
+        if(srnum < 0 || srnum >= num_sr || !sr.value.IsString() || !parse_titer(sr.value.GetString(), titer)){
+          #pragma omp atomic write
+          parsed = false;
+          break;
+        }
+        titer_table.set_titer_unchecked(ag, srnum, titer);
+      }
+    }
+  }
+
+  if(!parsed){
+    for (SizeType ag = 0; ag < td.Size(); ag++){
+      for (auto& sr : td[ag].GetObject()){
+        titer_table.set_titer_string(
+          ag, strtoimax( sr.name.GetString(), NULL, 10 ),
+          sr.value.GetString()
+        );
+      }
     }
   }
 
 }
 
 
-// [[Rcpp::export]]
-AcMap json_to_acmap(
-  std::string json
+// Convert a parsed json document to an acmap
+AcMap json_doc_to_acmap(
+  const Document &doc,
+  const Rcpp::Nullable<Rcpp::IntegerVector> &optimization_numbers,
+  const int &num_cores
 ){
 
-  // FILE* fp = fopen(filepath.c_str(), "rb"); // non-Windows use "r"
-  //
-  // char readBuffer[65536];
-  // FileReadStream is(fp, readBuffer, sizeof(readBuffer));
-
-  // Parse the json
-  Document doc;
-  // doc.ParseStream(is);
-  doc.Parse(json.c_str());
-
   // Perform some checks
   if(!doc.IsObject()){
     Rf_error("Could not parse file");
@@ -139,7 +164,7 @@ AcMap json_to_acmap(
     } else if (t.HasMember("d")){
 
       // This is for the case that titers are stored as a series of objects, each with names relating to the serum number
-      set_titers_from_json( map.titer_table_flat, t["d"] );
+      set_titers_from_json( map.titer_table_flat, t["d"], num_cores );
 
     } else {
 
@@ -161,7 +186,7 @@ AcMap json_to_acmap(
 
       // Parse layers
       for (int layer = 0; layer < num_layers; layer++){
-        set_titers_from_json( titer_table_layers[layer], t["L"][layer] );
+        set_titers_from_json( titer_table_layers[layer], t["L"][layer], num_cores );
       }
 
       // Add layers to map
@@ -194,35 +219,47 @@ AcMap json_to_acmap(
 
   // == OPTIMIZATION RUNS ======================
   // Rcpp::Rcout << "\n" << "OPTIMIZATIONS";
+  // Only the requested runs are decoded, so reading a map costs about the same
+  // however many other runs are stored in it
+  arma::uvec opt_indices = optimization_indices(
+    optimization_numbers,
+    c.HasMember("P") ? c["P"].Size() : 0
+  );
+
   if(c.HasMember("P")){
 
     const Value& P = c["P"]; // optimizations aka "projections"
 
     // Setup optimizations
-    std::vector<AcOptimization> optimizations( P.Size() );
-    for ( SizeType i=0; i<P.Size(); i++ ){
-      const Value& Opt = P[i];
+    map.optimizations.reserve( opt_indices.n_elem );
+    for ( arma::uword i=0; i<opt_indices.n_elem; i++ ){
+      const Value& Opt = P[opt_indices(i)];
+      const Value& l = Opt["l"];
 
       // Create optimization
       arma::uword num_dims = 0;
       for (int pt=0; pt < num_points; pt++) {
-        if (Opt["l"][pt].Size() > num_dims) {
-          num_dims = Opt["l"][pt].Size();
+        if (l[pt].Size() > num_dims) {
+          num_dims = l[pt].Size();
         }
       }
       AcOptimization optimization( num_dims, num_antigens, num_sera );
 
-      // Set coords
-      arma::mat coords( num_points, num_dims );
-      coords.fill( arma::datum::nan );
+      // Set coords, decoding straight into the antigen and sera matrices
+      arma::mat ag_coords( num_antigens, num_dims );
+      arma::mat sr_coords( num_sera, num_dims );
+      ag_coords.fill( arma::datum::nan );
+      sr_coords.fill( arma::datum::nan );
       for( int pt=0; pt < num_points; pt++){
-        for( SizeType dim=0; dim < Opt["l"][pt].Size(); dim++){
-          coords(pt, dim) = parse<double>(Opt["l"][pt][dim]);
+        const Value& lpt = l[pt];
+        for( SizeType dim=0; dim < lpt.Size(); dim++){
+          if (pt < num_antigens) ag_coords(pt, dim) = parse<double>(lpt[dim]);
+          else                   sr_coords(pt - num_antigens, dim) = parse<double>(lpt[dim]);
         }
       }
 
-      optimization.set_ag_base_coords(coords.rows(0, num_antigens - 1));
-      optimization.set_sr_base_coords(coords.rows(num_antigens, num_points - 1));
+      optimization.set_ag_base_coords( std::move(ag_coords) );
+      optimization.set_sr_base_coords( std::move(sr_coords) );
 
       // Set details
       if(Opt.HasMember("c")) optimization.set_comment(Opt["c"].GetString());
@@ -243,13 +280,10 @@ AcMap json_to_acmap(
       if(Opt.HasMember("s")) optimization.set_stress(parse<double>(Opt["s"]));
 
       // Add to optimizations
-      optimizations[i] = optimization;
+      map.optimizations.push_back( std::move(optimization) );
 
     }
 
-    // Add optimizations to the map
-    map.optimizations = optimizations;
-
   }
 
   // == EXTRAS =====================
@@ -282,8 +316,9 @@ AcMap json_to_acmap(
     // = OPTIMIZATIONS =
     if(x.HasMember("p")){
       const Value& xp = x["p"];
-      for(SizeType i=0; i<xp.Size(); i++){
-        const Value& xpi = xp[i];
+      for(arma::uword i=0; i<opt_indices.n_elem; i++){
+        if(opt_indices(i) >= xp.Size()) continue;
+        const Value& xpi = xp[opt_indices(i)];
         if(xpi.HasMember("t")) map.optimizations[i].set_translation( parse<arma::mat>(xpi["t"]));
         if(xpi.HasMember("b")) map.optimizations[i].bootstrap = parse<std::vector<NoisyBootstrapOutput>>(xpi["b"]);
       }
@@ -301,3 +336,60 @@ AcMap json_to_acmap(
 
 }
 
+
+// [[Rcpp::export]]
+AcMap json_to_acmap(
+  std::string json,
+  int num_cores = 1
+){
+
+  // Parse the json
+  Document doc;
+  doc.Parse(json.c_str());
+  return json_doc_to_acmap(doc, R_NilValue, num_cores);
+
+}
+
+
+// Read an acmap from a json file, decompressing and parsing the file as it is
+// read rather than reading the whole text into memory first. When only some
+// optimization runs are requested the others are skipped during the parse,
+// so they are never built in the parsed document
+// [[Rcpp::export]]
+AcMap json_file_to_acmap(
+  std::string filepath,
+  Rcpp::Nullable<Rcpp::IntegerVector> optimization_numbers = R_NilValue,
+  int num_cores = 1
+){
+
+  // Parse the json
+  Document doc;
+  {
+    AcJsonFileReadStream is(filepath);
+    if(optimization_numbers.isNull()){
+      doc.ParseStream(is);
+    } else {
+
+      // Work out which runs to keep
+      Rcpp::IntegerVector optnums(optimization_numbers.get());
+      std::vector<bool> keep_runs;
+      for(R_xlen_t i = 0; i < optnums.size(); i++){
+        if(optnums[i] < 1) continue;
+        if(keep_runs.size() < (std::size_t)optnums[i]) keep_runs.resize(optnums[i], false);
+        keep_runs[optnums[i] - 1] = true;
+      }
+
+      // Parse through the filter
+      auto parse_filtered = [&](Document &handler){
+        AcJsonOptimizationFilter filter(handler, keep_runs);
+        Reader reader;
+        return !reader.Parse(is, filter).IsError();
+      };
+      doc.Populate(parse_filtered);
+
+    }
+    if(is.failed()) Rcpp::stop("Could not decompress file '" + filepath + "'");
+  }
+  return json_doc_to_acmap(doc, optimization_numbers, num_cores);
+
+}
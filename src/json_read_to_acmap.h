@@ -8,7 +8,6 @@
 
 // [[Rcpp::depends(rapidjsonr)]]
 #include <rapidjson/document.h>
-// #include <rapidjson/filereadstream.h>
 using namespace rapidjson;
 
 #ifndef Racmacs__json_read_to_acmap__h
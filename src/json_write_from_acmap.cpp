@@ -5,109 +5,136 @@
 #include "acmap_point.h"
 #include "acmap_optimization.h"
 #include "json_write_from_acmap.h"
+#include "json_write_stream.h"
+#include "utils_file.h"
 using namespace rapidjson;
 
-// [[Rcpp::export]]
-std::string acmap_to_json(
-    AcMap map,
-    std::string version
+// Check whether two point styles would be written identically
+bool plotspecs_equal(
+    const AcPlotspec& a,
+    const AcPlotspec& b
 ){
 
-  // Setup the document
-  Document doc;
-  doc.SetObject();
-  Document::AllocatorType& allocator = doc.GetAllocator();
+  return a.get_shown() == b.get_shown() &&
+    a.get_fill() == b.get_fill() &&
+    a.get_outline() == b.get_outline() &&
+    a.get_outline_width() == b.get_outline_width() &&
+    a.get_shape() == b.get_shape() &&
+    a.get_size() == b.get_size() &&
+    a.get_rotation() == b.get_rotation() &&
+    a.get_aspect() == b.get_aspect();
 
-  // Add basic info
-  doc.AddMember("_", "-*- js-indent-level: 2 -*-", allocator);       // json info..?
-  doc.AddMember("  version", jsonifya(version, allocator), allocator); // Version info
-  doc.AddMember("?created", "", allocator);                          // Comment field
+}
 
-  // Map information
-  Value c(kObjectType);
-  Value i(kObjectType);
+// Write a point's basic details
+template <typename Writer>
+void write_point_json(
+    Writer& writer,
+    const AcPoint& pt
+){
+
+  writer.StartObject();
+  writer.Key("N"); write_json(writer, pt.get_name());
+  writer.Key("P"); write_json(writer, pt.get_passage());
+  // set_group_values
+  // set_date
+  // set_reference
+  // set_name_full
+  // set_name_abbreviated
+  // set_id
+  // set_group
+  // set_sequence
+  writer.EndObject();
+
+}
+
+// Write a point's extra details
+template <typename Writer>
+void write_point_extras_json(
+    Writer& writer,
+    const AcPoint& pt
+){
+
+  writer.StartObject();
+  writer.Key("g"); writer.Int(pt.get_group());
+  writer.Key("q"); write_json(writer, pt.get_sequence());
+  writer.Key("i"); write_json(writer, pt.get_id());
+  writer.EndObject();
+
+}
+
+// Write map data as json, streaming it to the writer as it is generated,
+// returns false if any values could not be written
+template <typename Writer>
+bool write_acmap_json(
+    Writer& writer,
+    const AcMap& map,
+    const std::string& version
+){
+
+  bool success = true;
   int num_antigens = map.antigens.size();
   int num_sera = map.sera.size();
   int num_points = num_antigens + num_sera;
 
-  // == INFO ============================
-  Value name;
-  name.SetString( StringRef(map.name.c_str()), allocator );
-  i.AddMember("N", name, allocator);
-
-  // == ANTIGENS ========================
-  Value a(kArrayType);
-  for( int i=0; i<num_antigens; i++ ){
-
-    AcAntigen& ag = map.antigens[i];
-    Value agval(kObjectType);
-
-    agval.AddMember("N", jsonifya(ag.get_name(), allocator), allocator);
-    agval.AddMember("P", jsonifya(ag.get_passage(), allocator), allocator);
-    // set_group_values
-    // set_date
-    // set_reference
-    // set_name_full
-    // set_name_abbreviated
-    // set_id
-    // set_group
-    // set_sequence
-    a.PushBack(agval, allocator);
+  writer.StartObject();
 
-  }
+  // Add basic info
+  writer.Key("_");         writer.String("-*- js-indent-level: 2 -*-"); // json info..?
+  writer.Key("  version"); write_json(writer, version);                 // Version info
+  writer.Key("?created");  writer.String("");                           // Comment field
 
+  // Map information
+  writer.Key("c");
+  writer.StartObject();
 
-  // == SERA ============================
-  Value s(kArrayType);
-  for( int i=0; i<num_sera; i++ ){
-
-    AcSerum& sr = map.sera[i];
-    Value srval(kObjectType);
-
-    srval.AddMember("N", jsonifya(sr.get_name(), allocator), allocator);
-    srval.AddMember("P", jsonifya(sr.get_passage(), allocator), allocator);
-    // set_group_values
-    // set_date
-    // set_reference
-    // set_name_full
-    // set_name_abbreviated
-    // set_id
-    // set_group
-    // set_sequence
-    s.PushBack(srval, allocator);
+  // == INFO ============================
+  writer.Key("i");
+  writer.StartObject();
+  writer.Key("N"); write_json(writer, map.name);
+  writer.EndObject();
 
-  }
+  // == ANTIGENS ========================
+  writer.Key("a");
+  writer.StartArray();
+  for(auto &ag : map.antigens) write_point_json(writer, ag);
+  writer.EndArray();
 
+  // == SERA ============================
+  writer.Key("s");
+  writer.StartArray();
+  for(auto &sr : map.sera) write_point_json(writer, sr);
+  writer.EndArray();
 
   // == TITERS ==========================
-  Value t(kObjectType);
-  Value d = jsonifya( map.titer_table_flat, allocator );
-  t.AddMember("d", d, allocator);
+  writer.Key("t");
+  writer.StartObject();
+  writer.Key("d");
+  write_json(writer, map.titer_table_flat);
 
   if(map.titer_table_layers.size() > 1){
-    Value L(kArrayType);
-    for(arma::uword layer=0; layer<map.titer_table_layers.size(); layer++){
-      Value titertableval = jsonifya( map.titer_table_layers[layer], allocator );
-      L.PushBack(titertableval, allocator);
+    writer.Key("L");
+    writer.StartArray();
+    for(auto &titer_table_layer : map.titer_table_layers){
+      write_json(writer, titer_table_layer);
     }
-    t.AddMember("L", L, allocator);
+    writer.EndArray();
   }
+  writer.EndObject();
 
   // == PLOTSPEC =====================
-  Value p(kObjectType);
-  Value ptstyles(kArrayType);
+  // Find the unique point styles
+  std::vector<const AcPlotspec*> ptstyles;
   arma::uvec ptstyle_indices( num_points );
 
-  // Antigens
-  for(int i=0; i<num_antigens; i++){
+  for(int i=0; i<num_points; i++){
 
-    // Generate the point style
-    Value ptstyle = jsonifya(map.antigens[i].plotspec, allocator);
+    const AcPlotspec& ptstyle = i < num_antigens ? map.antigens[i].plotspec : map.sera[i - num_antigens].plotspec;
 
     // Check if that point style already exists
     int ptstyle_index = -1;
-    for(SizeType j=0; j<ptstyles.Size(); j++){
-      if(ptstyles[j] == ptstyle){
+    for(SizeType j=0; j<ptstyles.size(); j++){
+      if(plotspecs_equal(*ptstyles[j], ptstyle)){
         ptstyle_index = j;
         break;
       }
@@ -115,8 +142,8 @@ std::string acmap_to_json(
 
     // Add the point style if not already found
     if(ptstyle_index == -1){
-      ptstyles.PushBack(ptstyle, allocator);
-      ptstyle_index = ptstyles.Size() - 1;
+      ptstyles.push_back(&ptstyle);
+      ptstyle_index = ptstyles.size() - 1;
     }
 
     // Record the point style index
@@ -124,197 +151,134 @@ std::string acmap_to_json(
 
   }
 
-  // Sera
-  for(int i=0; i<num_sera; i++){
-
-    // Generate the point style
-    Value ptstyle = jsonifya(map.sera[i].plotspec, allocator);
-
-    // Check if that point style already exists
-    int ptstyle_index = -1;
-    for(SizeType j=0; j<ptstyles.Size(); j++){
-      if(ptstyles[j] == ptstyle){
-        ptstyle_index = j;
-        break;
-      }
-    }
-
-    // Add the point style if not already found
-    if(ptstyle_index == -1){
-      ptstyles.PushBack(ptstyle, allocator);
-      ptstyle_index = ptstyles.Size() - 1;
-    }
-
-    // Record the point style index
-    ptstyle_indices[i + num_antigens] = ptstyle_index;
-
+  writer.Key("p");
+  writer.StartObject();
+  writer.Key("p");
+  write_json(writer, ptstyle_indices);
+  writer.Key("P");
+  writer.StartArray();
+  for(auto &ptstyle : ptstyles){
+    success &= write_json(writer, *ptstyle);
   }
-
-  // Add to the plotspec json
-  p.AddMember("p", jsonifya(ptstyle_indices, allocator), allocator);
-  p.AddMember("P", ptstyles, allocator);
+  writer.EndArray();
 
   // Drawing order
-  p.AddMember("d", jsonifya(map.get_pt_drawing_order(), allocator), allocator);
+  writer.Key("d");
+  write_json(writer, map.get_pt_drawing_order());
+  writer.EndObject();
 
 
   // == OPTIMIZATION RUNS ======================
-  Value P(kArrayType); // optimizations aka "projections"
+  writer.Key("P"); // optimizations aka "projections"
+  writer.StartArray();
 
-  // Add optimizations
-  for(arma::uword i=0; i<map.optimizations.size(); i++){
+  for(auto &optimization : map.optimizations){
 
-    Value optjson(kObjectType);
+    writer.StartObject();
 
     // Comment
-    optjson.AddMember("c", jsonifya(map.optimizations[i].get_comment(), allocator), allocator);
+    writer.Key("c"); write_json(writer, optimization.get_comment());
 
     // Stress
-    optjson.AddMember("s", jsonify(map.optimizations[i].stress), allocator);
+    writer.Key("s"); write_json(writer, optimization.stress);
 
     // Minimum column basis
-    optjson.AddMember("m", jsonifya(map.optimizations[i].get_min_column_basis(), allocator), allocator);
+    writer.Key("m"); write_json(writer, optimization.get_min_column_basis());
 
     // Fixed column bases
-    optjson.AddMember("C", jsonifya( map.optimizations[i].get_fixed_column_bases(), allocator), allocator);
+    writer.Key("C"); write_json(writer, optimization.get_fixed_column_bases());
 
     // Transformation
-    arma::vec transformation_vec = arma::vectorise( map.optimizations[i].get_transformation() );
-    optjson.AddMember("t", jsonifya( transformation_vec , allocator ), allocator);
-
-    // Coords
-    arma::mat coords = arma::join_cols( map.optimizations[i].get_ag_base_coords(), map.optimizations[i].get_sr_base_coords() );
-    optjson.AddMember("l", jsonifya( coords, allocator ), allocator);
+    arma::vec transformation_vec = arma::vectorise( optimization.get_transformation() );
+    writer.Key("t"); write_json(writer, transformation_vec);
+
+    // Coords, antigens then sera
+    writer.Key("l");
+    writer.StartArray();
+    const arma::mat& ag_coords = optimization.get_ag_base_coords();
+    const arma::mat& sr_coords = optimization.get_sr_base_coords();
+    for(const arma::mat* coords : { &ag_coords, &sr_coords }){
+      for( arma::uword i=0; i<coords->n_rows; i++ ){
+        writer.StartArray();
+        for( arma::uword j=0; j<coords->n_cols; j++ ){
+          write_json(writer, (*coords)(i, j));
+        }
+        writer.EndArray();
+      }
+    }
+    writer.EndArray();
 
-    // Add to array
-    P.PushBack(optjson, allocator);
+    writer.EndObject();
 
   }
+  writer.EndArray();
 
   // == EXTRAS ==================================
-  Value x(kObjectType);
+  writer.Key("x");
+  writer.StartObject();
 
   // = AGs =
-  Value xa(kArrayType);
-  for(arma::uword i=0; i<map.antigens.size(); i++){
-    Value agx(kObjectType);
-    agx.AddMember("g", map.antigens[i].get_group(), allocator);
-    agx.AddMember("q", jsonifya(map.antigens[i].get_sequence(), allocator), allocator);
-    agx.AddMember("i", jsonifya(map.antigens[i].get_id(), allocator), allocator);
-    xa.PushBack(agx, allocator);
-  }
-  x.AddMember("a", xa, allocator);
+  writer.Key("a");
+  writer.StartArray();
+  for(auto &ag : map.antigens) write_point_extras_json(writer, ag);
+  writer.EndArray();
 
   // = SR =
-  Value xs(kArrayType);
-  for(arma::uword i=0; i<map.sera.size(); i++){
-    Value srx(kObjectType);
-    srx.AddMember("g", map.sera[i].get_group(), allocator);
-    srx.AddMember("q", jsonifya(map.sera[i].get_sequence(), allocator), allocator);
-    srx.AddMember("i", jsonifya(map.sera[i].get_id(), allocator), allocator);
-    xs.PushBack(srx, allocator);
-  }
-  x.AddMember("s", xs, allocator);
+  writer.Key("s");
+  writer.StartArray();
+  for(auto &sr : map.sera) write_point_extras_json(writer, sr);
+  writer.EndArray();
 
   // = OPTIMIZATIONS =
-  Value xp(kArrayType);
-  for(arma::uword i=0; i<map.optimizations.size(); i++){
+  writer.Key("p");
+  writer.StartArray();
+  for(auto &optimization : map.optimizations){
 
-    Value optx(kObjectType);
+    writer.StartObject();
 
     // Translation
-    optx.AddMember(
-      "t",
-      jsonifya(
-        arma::conv_to<arma::vec>::from(map.optimizations[i].get_translation()),
-        allocator
-      ),
-      allocator
-    );
+    writer.Key("t");
+    write_json(writer, arma::conv_to<arma::vec>::from(optimization.get_translation()));
 
     // Bootstrapping
-    if (map.optimizations[i].bootstrap.size() > 0) {
-      optx.AddMember(
-        "b",
-        jsonifya(map.optimizations[i].bootstrap, allocator),
-        allocator
-      );
+    if (optimization.bootstrap.size() > 0) {
+      writer.Key("b");
+      write_json(writer, optimization.bootstrap);
     }
 
-    // // Hemisphering
-    // for(arma::uword ag=0; ag<map.optimizations[i].ag_diagnostics.size(); ag++){
-    //   if (map.optimizations[i].ag_diagnostics[ag].hemi.size() > 0) {
-    //     Value key(
-    //         std::to_string(ag).c_str(),
-    //         allocator
-    //     );
-    //     optxh.AddMember(
-    //       key,
-    //       jsonifya(
-    //         map.optimizations[i].ag_diagnostics[ag].hemi,
-    //         allocator
-    //       ),
-    //       allocator
-    //     );
-    //   }
-    // }
-    //
-    // for(arma::uword sr=0; sr<map.optimizations[i].sr_diagnostics.size(); sr++){
-    //   if (map.optimizations[i].sr_diagnostics[sr].hemi.size() > 0) {
-    //     Value key(
-    //         std::to_string(sr + num_antigens).c_str(),
-    //         allocator
-    //     );
-    //     optxh.AddMember(
-    //       key,
-    //       jsonifya(
-    //         map.optimizations[i].sr_diagnostics[sr].hemi,
-    //         allocator
-    //       ),
-    //       allocator
-    //     );
-    //   }
-    // }
-    //
-    // if (optxh.Size() > 0) {
-    //   optx.AddMember("h", optxh, allocator);
-    // }
-
-    xp.PushBack(optx, allocator);
+    writer.EndObject();
 
   }
-  x.AddMember("p", xp, allocator);
+  writer.EndArray();
 
   // = OTHER =
-  x.AddMember("agv", jsonifya(map.get_ag_group_levels(), allocator), allocator);
-  x.AddMember("srv", jsonifya(map.get_sr_group_levels(), allocator), allocator);
+  writer.Key("agv"); write_json(writer, map.get_ag_group_levels());
+  writer.Key("srv"); write_json(writer, map.get_sr_group_levels());
+  writer.EndObject();
 
   // == FINISH UP ===============================
-  // Assemble the json map data and add it
-  c.AddMember("i", i, allocator);
-  c.AddMember("a", a, allocator);
-  c.AddMember("s", s, allocator);
-  c.AddMember("t", t, allocator);
-  c.AddMember("p", p, allocator);
-  c.AddMember("P", P, allocator);
-  c.AddMember("x", x, allocator);
-  doc.AddMember("c", c, allocator);
-
-  // Return the map
+  writer.EndObject();
+  writer.EndObject();
+
+  return success && writer.IsComplete();
+
+}
+
+
+// [[Rcpp::export]]
+std::string acmap_to_json(
+    AcMap map,
+    std::string version
+){
+
+  // Write the map
   StringBuffer buffer;
   Writer<StringBuffer> writer(buffer);
-  // Writer<
-  //   StringBuffer, // Output Stream
-  //   UTF8<>,       // Source Encoding
-  //   UTF8<>,       // Target Encoding
-  //   CrtAllocator,
-  //   kWriteNanAndInfFlag
-  //   > writer(buffer);
-  bool success = doc.Accept(writer);
+  bool success = write_acmap_json(writer, map, version);
 
   // Check for errors
   if(!success){
-    Rf_error("Parsing to json .ace format failed");
+    Rcpp::stop("Parsing to json .ace format failed");
   }
 
   // Return the string
@@ -322,3 +286,34 @@ std::string acmap_to_json(
 
 }
 
+
+// Write map json straight to a file, optionally compressed with "xz" or
+// "gzip", without holding the json text in memory. The json is written to a
+// temporary file first so an existing file is only replaced once the map has
+// been written successfully
+// [[Rcpp::export]]
+void acmap_to_json_file(
+    AcMap map,
+    std::string version,
+    std::string filepath,
+    std::string compression
+){
+
+  AcTempFile tempfile(filepath);
+  AcJsonFileWriteStream os(tempfile.temppath, compression);
+  Writer<AcJsonFileWriteStream> writer(os);
+  bool success = write_acmap_json(writer, map, version);
+  os.close();
+
+  // Check for errors, the temporary file is removed on leaving
+  if(!success){
+    Rcpp::stop("Parsing to json .ace format failed");
+  }
+  if(os.failed()){
+    Rcpp::stop("Failed to write file '" + filepath + "'");
+  }
+
+  // Replace the file
+  tempfile.commit();
+
+}
@@ -4,185 +4,170 @@
 
 #include "json_assert.h"
 // [[Rcpp::depends(rapidjsonr)]]
-#include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
-// #include <rapidjson/filereadstream.h>
 
 #ifndef Racmacs__json_write_from_acmap__h
 #define Racmacs__json_write_from_acmap__h
 
-// Setup general template for conversions
+// Functions for writing map data straight to a rapidjson writer, so the json
+// is streamed out as it is generated rather than first built as a document
 using namespace rapidjson;
-template <typename T> Value jsonify(const T& object);
 
-// To double
-template <>
-Value jsonify(
+// To double, non-finite values are written as null
+template <typename Writer>
+void write_json(
+    Writer& writer,
     const double& d
 ){
 
-  Value val;
   if(std::isfinite(d)){
-    val.SetDouble(d);
+    writer.Double(d);
   } else {
-    val.SetNull();
+    writer.Null();
   }
-  return val;
 
 }
 
-// Setup general template for conversions using allocator
-template <typename T> Value jsonifya(const T& object, Document::AllocatorType& allocator);
-
 // To string
-template <>
-Value jsonifya(
-    const std::string& s,
-    Document::AllocatorType& allocator
+template <typename Writer>
+void write_json(
+    Writer& writer,
+    const std::string& s
 ){
 
-  Value val;
-  val.SetString( StringRef(s.c_str()), allocator );
-  return val;
+  writer.String(s.c_str());
 
 }
 
 // To string array
-template <>
-Value jsonifya(
-    const std::vector<std::string>& stringvec,
-    Document::AllocatorType& allocator
+template <typename Writer>
+void write_json(
+    Writer& writer,
+    const std::vector<std::string>& stringvec
 ){
 
-  Value strvecjson(kArrayType);
+  writer.StartArray();
   for(SizeType i=0; i<stringvec.size(); i++){
-    strvecjson.PushBack(
-      jsonifya( stringvec[i], allocator ),
-      allocator
-    );
+    write_json(writer, stringvec[i]);
   }
-  return strvecjson;
+  writer.EndArray();
 
 }
 
 // From arma::vec
-template <>
-Value jsonifya(
-    const arma::vec& x,
-    Document::AllocatorType& allocator
+template <typename Writer>
+void write_json(
+    Writer& writer,
+    const arma::vec& x
 ){
 
-  Value a(kArrayType);
+  writer.StartArray();
   for( arma::uword i=0; i<x.n_elem; i++ ){
-    if(std::isfinite(x(i))){
-      a.PushBack(x(i), allocator);
-    } else {
-      Value null(kNullType);
-      a.PushBack(null, allocator);
-    }
+    write_json(writer, x(i));
   }
-  return a;
+  writer.EndArray();
 
 }
 
-template <>
-Value jsonifya(
-    const arma::uvec& x,
-    Document::AllocatorType& allocator
+template <typename Writer>
+void write_json(
+    Writer& writer,
+    const arma::uvec& x
 ){
 
-  Value a(kArrayType);
+  writer.StartArray();
   for( arma::uword i=0; i<x.n_elem; i++ ){
-    a.PushBack(x(i), allocator);
+    writer.Uint(x(i));
   }
-  return a;
+  writer.EndArray();
 
 }
 
-// From arma::mat
-template <>
-Value jsonifya(
-    const arma::mat& m,
-    Document::AllocatorType& allocator
+// From arma::mat, as an array of rows
+template <typename Writer>
+void write_json(
+    Writer& writer,
+    const arma::mat& m
 ){
 
-  Value a(kArrayType);
+  writer.StartArray();
   for( arma::uword i=0; i<m.n_rows; i++ ){
-    arma::vec row = arma::vectorise( m.row(i) );
-    a.PushBack(
-      jsonifya(row, allocator),
-      allocator
-    );
+    writer.StartArray();
+    for( arma::uword j=0; j<m.n_cols; j++ ){
+      write_json(writer, m(i, j));
+    }
+    writer.EndArray();
   }
-  return a;
+  writer.EndArray();
 
 }
 
 // From titer table to json
-template <>
-Value jsonifya(
-    const AcTiterTable& titertable,
-    Document::AllocatorType& allocator
+template <typename Writer>
+void write_json(
+    Writer& writer,
+    const AcTiterTable& titertable
 ){
 
-  Value agrows(kArrayType);
+  writer.StartArray();
   for(SizeType ag=0; ag<titertable.nags(); ag++){
-    Value srtiters(kObjectType);
+    writer.StartObject();
     for(SizeType sr=0; sr<titertable.nsr(); sr++){
       if(titertable.titer_measured(ag, sr)){
-        srtiters.AddMember(
-          jsonifya( std::to_string(sr), allocator ),
-          jsonifya(titertable.get_titer_string(ag, sr), allocator),
-          allocator
-        );
+        writer.Key(std::to_string(sr).c_str());
+        write_json(writer, titertable.get_titer_string(ag, sr));
       }
     }
-    agrows.PushBack(srtiters, allocator);
+    writer.EndObject();
   }
-  return agrows;
+  writer.EndArray();
 
 }
 
-// From plotspec to json
-template <>
-Value jsonifya(
-    const AcPlotspec& plotspec,
-    Document::AllocatorType& allocator
+// From plotspec to json, returning false if a value could not be written
+template <typename Writer>
+bool write_json(
+    Writer& writer,
+    const AcPlotspec& plotspec
 ){
 
-  Value ptstyle(kObjectType);
-  ptstyle.AddMember("+", plotspec.get_shown(), allocator);
-  ptstyle.AddMember("F", jsonifya(plotspec.get_fill(), allocator), allocator);
-  ptstyle.AddMember("O", jsonifya(plotspec.get_outline(), allocator), allocator);
-  ptstyle.AddMember("o", plotspec.get_outline_width(), allocator);
-  ptstyle.AddMember("S", jsonifya(plotspec.get_shape(), allocator), allocator);
-  ptstyle.AddMember("s", plotspec.get_size(), allocator);
-  ptstyle.AddMember("r", plotspec.get_rotation(), allocator);
-  ptstyle.AddMember("a", plotspec.get_aspect(), allocator);
-  return ptstyle;
+  bool success = true;
+  writer.StartObject();
+  writer.Key("+"); writer.Bool(plotspec.get_shown());
+  writer.Key("F"); write_json(writer, plotspec.get_fill());
+  writer.Key("O"); write_json(writer, plotspec.get_outline());
+  writer.Key("o"); success &= writer.Double(plotspec.get_outline_width());
+  writer.Key("S"); write_json(writer, plotspec.get_shape());
+  writer.Key("s"); success &= writer.Double(plotspec.get_size());
+  writer.Key("r"); success &= writer.Double(plotspec.get_rotation());
+  writer.Key("a"); success &= writer.Double(plotspec.get_aspect());
+  writer.EndObject();
+  return success;
 
 }
 
-// From arma::mat
-template <>
-Value jsonifya(
-    const std::vector<NoisyBootstrapOutput>& bootstraps,
-    Document::AllocatorType& allocator
+// From bootstrap results
+template <typename Writer>
+void write_json(
+    Writer& writer,
+    const std::vector<NoisyBootstrapOutput>& bootstraps
 ){
 
-  Value bs(kObjectType);
-  Value ag_noise(kArrayType);
-  Value coords(kArrayType);
-
+  writer.StartObject();
+  writer.Key("coords");
+  writer.StartArray();
   for(auto &bootstrap : bootstraps){
-    ag_noise.PushBack(jsonifya(bootstrap.ag_noise, allocator), allocator);
-    coords.PushBack(jsonifya(bootstrap.coords, allocator), allocator);
+    write_json(writer, bootstrap.coords);
   }
-
-  bs.AddMember("coords", coords, allocator);
-  bs.AddMember("ag_noise", ag_noise, allocator);
-  return bs;
+  writer.EndArray();
+  writer.Key("ag_noise");
+  writer.StartArray();
+  for(auto &bootstrap : bootstraps){
+    write_json(writer, bootstrap.ag_noise);
+  }
+  writer.EndArray();
+  writer.EndObject();
 
 }
 
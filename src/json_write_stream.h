@@ -0,0 +1,175 @@
+
+#include <RcppArmadillo.h>
+#include <cstdio>
+#include <zlib.h>
+#include <lzma.h>
+
+// [[Rcpp::depends(rapidjsonr)]]
+#include <rapidjson/rapidjson.h>
+
+#ifndef Racmacs__json_write_stream__h
+#define Racmacs__json_write_stream__h
+
+// A rapidjson write stream that writes json to a file in chunks as it is
+// generated, optionally compressing it with xz through liblzma or with gzip
+// through zlib. Modelled on rapidjson's FileWriteStream.
+class AcJsonFileWriteStream {
+
+  public:
+
+    typedef char Ch;
+
+    // Constructor, compression is one of "none", "gzip" or "xz"
+    AcJsonFileWriteStream(
+      const std::string &filepath,
+      const std::string &compression
+    ):
+      buffer_(buffer_size),
+      out_buffer_(buffer_size),
+      count_(0),
+      failed_(false),
+      closed_(false),
+      xz_(compression == "xz"),
+      fp_(NULL),
+      gz_(NULL)
+    {
+
+      lzma_stream lzma_init = LZMA_STREAM_INIT;
+      lzma_ = lzma_init;
+
+      if(compression == "gzip"){
+
+        gz_ = gzopen(filepath.c_str(), "wb");
+        if(gz_ == NULL) Rcpp::stop("File '" + filepath + "' could not be opened for writing");
+        gzbuffer(gz_, buffer_size);
+
+      } else if(compression == "xz" || compression == "none"){
+
+        fp_ = fopen(filepath.c_str(), "wb");
+        if(fp_ == NULL) Rcpp::stop("File '" + filepath + "' could not be opened for writing");
+        if(xz_ && lzma_easy_encoder(&lzma_, 6, LZMA_CHECK_CRC32) != LZMA_OK){
+          fclose(fp_);
+          fp_ = NULL;
+          Rcpp::stop("Could not initialise xz compression");
+        }
+
+      } else {
+
+        Rcpp::stop("Unknown compression '" + compression + "'");
+
+      }
+
+    }
+
+    // Destructor
+    ~AcJsonFileWriteStream(){
+      if(fp_ != NULL) fclose(fp_);
+      if(gz_ != NULL) gzclose(gz_);
+      lzma_end(&lzma_);
+    }
+
+    // Stream interface
+    void Put(Ch c) {
+      if(count_ == buffer_size) Flush();
+      buffer_[count_++] = c;
+    }
+
+    void Flush() {
+      Write(&buffer_[0], count_, false);
+      count_ = 0;
+    }
+
+    // Not implemented
+    Ch Peek() const { RAPIDJSON_ASSERT(false); return 0; }
+    Ch Take() { RAPIDJSON_ASSERT(false); return 0; }
+    size_t Tell() const { RAPIDJSON_ASSERT(false); return 0; }
+    Ch* PutBegin() { RAPIDJSON_ASSERT(false); return 0; }
+    size_t PutEnd(Ch*) { RAPIDJSON_ASSERT(false); return 0; }
+
+    // Flush remaining output, finish compression and close the file
+    void close(){
+
+      if(closed_) return;
+      Write(&buffer_[0], count_, true);
+      count_ = 0;
+      closed_ = true;
+
+      if(gz_ != NULL){
+        if(gzclose(gz_) != Z_OK) failed_ = true;
+        gz_ = NULL;
+      }
+      if(fp_ != NULL){
+        if(fclose(fp_) != 0) failed_ = true;
+        fp_ = NULL;
+      }
+
+    }
+
+    // Check whether writing or compressing the file failed
+    bool failed() const { return failed_; }
+
+  private:
+
+    static const size_t buffer_size = 65536;
+
+    std::vector<Ch> buffer_;
+    std::vector<uint8_t> out_buffer_;
+    size_t count_;
+    bool failed_;
+    bool closed_;
+    bool xz_;
+
+    FILE *fp_;
+    gzFile gz_;
+    lzma_stream lzma_;
+
+    // Write a chunk of characters, compressing them if needed
+    void Write(
+        const Ch *data,
+        size_t n,
+        bool finish
+    ){
+
+      if(failed_) return;
+
+      // Write through zlib
+      if(gz_ != NULL){
+        if(n > 0 && gzwrite(gz_, data, static_cast<unsigned int>(n)) == 0) failed_ = true;
+        return;
+      }
+
+      // Write uncompressed
+      if(!xz_){
+        if(fwrite(data, 1, n, fp_) != n) failed_ = true;
+        return;
+      }
+
+      // Compress with xz
+      lzma_.next_in = reinterpret_cast<const uint8_t*>(data);
+      lzma_.avail_in = n;
+      lzma_action action = finish ? LZMA_FINISH : LZMA_RUN;
+
+      while(lzma_.avail_in > 0 || finish){
+
+        lzma_.next_out = &out_buffer_[0];
+        lzma_.avail_out = out_buffer_.size();
+        lzma_ret ret = lzma_code(&lzma_, action);
+        if(ret != LZMA_OK && ret != LZMA_STREAM_END){
+          failed_ = true;
+          return;
+        }
+
+        size_t nout = out_buffer_.size() - lzma_.avail_out;
+        if(fwrite(&out_buffer_[0], 1, nout, fp_) != nout){
+          failed_ = true;
+          return;
+        }
+        if(ret == LZMA_STREAM_END) break;
+
+      }
+
+    }
+
+};
+
+#endif
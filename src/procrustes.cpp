@@ -3,8 +3,77 @@
 #include "acmap_map.h"
 #include "procrustes.h"
 #include "utils.h"
+#include "utils_parallel.h"
 using namespace Rcpp;
 
+// Calculate the procrustes transformation from source to target coordinates
+// with matching rows and columns. When finding a translation the coordinates
+// passed are centred on the means given, which is equivalent to applying the
+// centering matrix J = I - 1/n without forming it.
+Procrustes procrustes_from_centred(
+    const arma::mat &Xc,
+    const arma::rowvec &X_mean,
+    const arma::mat &Xstar_c,
+    const arma::rowvec &Xstar_mean,
+    bool translation,
+    bool dilation
+){
+
+  int m = Xc.n_cols;
+  arma::mat C = Xstar_c.t() * Xc;
+
+  arma::vec svd_d;
+  arma::mat svd_u;
+  arma::mat svd_v;
+  arma::svd(
+    svd_u,
+    svd_d,
+    svd_v,
+    C
+  );
+
+  arma::mat R = svd_v * svd_u.t();
+  double s = 1.0;
+
+  if(dilation){
+
+    // trace(tXstar J X R) / trace(tX J X)
+    s = arma::accu(C % R.t()) / arma::accu(arma::square(Xc));
+
+  }
+
+  arma::mat tt = arma::mat(m, 1, arma::fill::zeros);
+  if(translation){
+
+    // Mean of the rows of Xstar - s X R
+    tt = arma::trans(Xstar_mean - s * X_mean * R);
+
+  }
+
+  Procrustes out;
+  out.R = R;
+  out.tt = tt;
+  out.s = s;
+  return out;
+
+}
+
+// Centre coordinates in place, returning the column means, these are left at
+// zero if no translation is to be found
+arma::rowvec centre_coords(
+    arma::mat &X,
+    bool translation
+){
+
+  arma::rowvec X_mean(X.n_cols, arma::fill::zeros);
+  if(translation && X.n_rows > 0){
+    X_mean = arma::mean(X, 0);
+    X.each_row() -= X_mean;
+  }
+  return X_mean;
+
+}
+
 // Define a procrustes transformation
 // [[Rcpp::export]]
 Procrustes ac_procrustes(
@@ -29,64 +98,111 @@ Procrustes ac_procrustes(
   X.resize(X.n_rows, dims);
   Xstar.resize(X.n_rows, dims);
 
-  // Perform the calculation
-  int n = X.n_rows;
-  int m = X.n_cols;
+  // Perform the calculation on the centred coordinates
+  arma::rowvec X_mean = centre_coords(X, translation);
+  arma::rowvec Xstar_mean = centre_coords(Xstar, translation);
 
-  arma::mat J = arma::mat(n,n,arma::fill::eye);
-  if(translation){
-    J -= (1.0/n);
-  }
+  return procrustes_from_centred(
+    X, X_mean,
+    Xstar, Xstar_mean,
+    translation,
+    dilation
+  );
 
-  arma::mat tX = arma::trans(X);
-  arma::mat tXstar = arma::trans(Xstar);
+}
 
-  arma::mat C = tXstar * J * X;
+// Prepare target coordinates for aligning many sets of coordinates to them,
+// excluding NaN rows and centring the coordinates once
+ProcrustesTarget ac_procrustes_target(
+    const arma::mat &Xstar,
+    bool translation,
+    bool dilation
+){
 
+  ProcrustesTarget target;
+  target.coords = Xstar;
+  target.na_rows = na_row_indices(Xstar);
+  target.na_mask = arma::uvec(Xstar.n_rows, arma::fill::zeros);
+  target.na_mask.elem(target.na_rows).ones();
+  target.centred_coords = Xstar;
+  target.centred_coords.shed_rows(target.na_rows);
+  target.mean = centre_coords(target.centred_coords, translation);
+  target.translation = translation;
+  target.dilation = dilation;
+  return target;
 
-  arma::vec svd_d;
-  arma::mat svd_u;
-  arma::mat svd_v;
-  arma::svd(
-    svd_u,
-    svd_d,
-    svd_v,
-    C
-  );
+}
 
-  arma::mat R = svd_v * svd_u.t();
-  double s = 1.0;
+// Define a procrustes transformation to a prepared target, source coordinates
+// with NaN rows that are not NaN in the target fall back to ac_procrustes()
+Procrustes ac_procrustes_to_target(
+    const arma::mat &X,
+    const ProcrustesTarget &target
+){
 
-  if(dilation){
+  // Check input
+  if(X.n_rows != target.coords.n_rows){ Rf_error("X and Xstar do not have same number of rows."); }
+
+  arma::uvec na_rows = na_row_indices(X);
+  for(arma::uword i=0; i<na_rows.n_elem; i++){
+    if(!target.na_mask(na_rows(i))){
+      return ac_procrustes(X, target.coords, target.translation, target.dilation);
+    }
+  }
 
-    arma::mat mat1 = tXstar * J * X * R;
-    arma::mat mat2 = tX * J * X;
+  // Expand coords to match maximum dimensions
+  arma::uword dims = std::max(X.n_cols, target.centred_coords.n_cols);
+  arma::mat Xc = X;
+  Xc.shed_rows(target.na_rows);
+  Xc.resize(Xc.n_rows, dims);
+  arma::rowvec X_mean = centre_coords(Xc, target.translation);
+
+  if(target.centred_coords.n_cols == dims){
+    return procrustes_from_centred(
+      Xc, X_mean,
+      target.centred_coords, target.mean,
+      target.translation,
+      target.dilation
+    );
+  }
 
-    double s_numer = 0.0;
-    double s_denom = 0.0;
+  arma::mat Xstar_c = target.centred_coords;
+  Xstar_c.resize(Xstar_c.n_rows, dims);
+  arma::rowvec Xstar_mean = target.mean;
+  Xstar_mean.resize(dims);
+  return procrustes_from_centred(
+    Xc, X_mean,
+    Xstar_c, Xstar_mean,
+    target.translation,
+    target.dilation
+  );
 
-    for(int i=0; i<m; i++){
-      s_numer += mat1(i,i);
-      s_denom += mat2(i,i);
-    }
+}
 
-    s = s_numer / s_denom;
+// Define procrustes transformations of many coordinate sets to the same
+// target, centring the target coordinates only once
+// [[Rcpp::export]]
+std::vector<Procrustes> ac_procrustes_batch(
+    const std::vector<arma::mat> &Xs,
+    const arma::mat &Xstar,
+    bool translation,
+    bool dilation,
+    const int &num_cores
+){
 
+  // Check input before the parallel region since errors cannot be raised from it
+  for(auto &X : Xs){
+    if(X.n_rows != Xstar.n_rows){ Rf_error("X and Xstar do not have same number of rows."); }
   }
 
-  arma::mat tt = arma::mat(m, 1, arma::fill::zeros);
-  if(translation){
-
-    arma::mat mat1 = arma::mat(n, 1, arma::fill::ones);
-    arma::mat tmatmid = arma::trans(Xstar - s * X * R);
-    tt = ((1.0/n) * tmatmid)*mat1;
+  ProcrustesTarget target = ac_procrustes_target(Xstar, translation, dilation);
+  std::vector<Procrustes> out(Xs.size());
 
+  #pragma omp parallel for schedule(dynamic) num_threads(ac_num_threads(num_cores))
+  for(arma::uword i=0; i<Xs.size(); i++){
+    out[i] = ac_procrustes_to_target(Xs[i], target);
   }
 
-  Procrustes out;
-  out.R = R;
-  out.tt = tt;
-  out.s = s;
   return out;
 
 }
@@ -26,6 +26,19 @@ struct ProcrustesData
   double total_rmsd;
 };
 
+// A procrustes target with NaN rows excluded and the coordinates centred, for
+// aligning many sets of coordinates to the same target
+struct ProcrustesTarget
+{
+  arma::mat coords;
+  arma::mat centred_coords;
+  arma::rowvec mean;
+  arma::uvec na_rows;
+  arma::uvec na_mask;
+  bool translation;
+  bool dilation;
+};
+
 Procrustes ac_procrustes(
     arma::mat X,
     arma::mat Xstar,
@@ -33,6 +46,37 @@ Procrustes ac_procrustes(
     bool dilation = false
 );
 
+ProcrustesTarget ac_procrustes_target(
+    const arma::mat &Xstar,
+    bool translation = true,
+    bool dilation = false
+);
+
+Procrustes ac_procrustes_to_target(
+    const arma::mat &X,
+    const ProcrustesTarget &target
+);
+
+std::vector<Procrustes> ac_procrustes_batch(
+    const std::vector<arma::mat> &Xs,
+    const arma::mat &Xstar,
+    bool translation = true,
+    bool dilation = false,
+    const int &num_cores = 1
+);
+
+arma::mat ac_apply_procrustes(
+    arma::mat coords,
+    Procrustes p
+);
+
+arma::mat ac_align_coords(
+    arma::mat source,
+    arma::mat target,
+    bool translation,
+    bool dilation
+);
+
 arma::mat transform_coords(
     const arma::mat &coords,
     const arma::mat &rotation,
@@ -122,6 +122,40 @@ arma::mat unique_rows(
 }
 
 
+// Convert optimization numbers requested from R (1-based) to indices, checking
+// they are in range, or return all indices when no numbers are given
+arma::uvec optimization_indices(
+  const Rcpp::Nullable<Rcpp::IntegerVector> &optimization_numbers,
+  const arma::uword &num_optimizations
+){
+
+  if (optimization_numbers.isNull()) {
+    arma::uvec indices(num_optimizations);
+    for (arma::uword i = 0; i < num_optimizations; i++) indices(i) = i;
+    return indices;
+  }
+
+  Rcpp::IntegerVector optnums(optimization_numbers.get());
+  if (optnums.size() > 0 && num_optimizations == 0) {
+    Rcpp::stop("Map has no optimization runs");
+  }
+
+  arma::uvec indices(optnums.size());
+  for (R_xlen_t i = 0; i < optnums.size(); i++) {
+    if (optnums[i] < 1 || optnums[i] > (int)num_optimizations) {
+      Rcpp::stop(
+        "Map only has " + std::to_string(num_optimizations) +
+        " optimization runs, but number " + std::to_string(optnums[i]) +
+        " requested"
+      );
+    }
+    indices(i) = optnums[i] - 1;
+  }
+  return indices;
+
+}
+
+
 // Check if openmp is used to run code in parallel
 // [[Rcpp::export]]
 bool parallel_mode(){
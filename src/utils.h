@@ -31,6 +31,11 @@ arma::mat unique_rows(
         const arma::mat& m
 );
 
+arma::uvec optimization_indices(
+    const Rcpp::Nullable<Rcpp::IntegerVector> &optimization_numbers,
+    const arma::uword &num_optimizations
+);
+
 // Template for subsetting a vector
 template<typename T>
 std::vector<T> subset_vector(
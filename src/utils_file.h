@@ -0,0 +1,51 @@
+#include <RcppArmadillo.h>
+#include <cstdio>
+
+#ifndef Racmacs__utils_file__h
+#define Racmacs__utils_file__h
+
+// A temporary file in the same directory as a file being written, moved over
+// the file only once writing has finished so that a failed write never leaves
+// a partial file in place of an existing one. The temporary file is removed
+// if it is not committed.
+class AcTempFile {
+
+  private:
+
+    bool committed;
+
+  public:
+
+    const std::string filepath;
+    const std::string temppath;
+
+    // Constructor
+    AcTempFile(
+      const std::string &filepath
+    ):
+      committed(false),
+      filepath(filepath),
+      temppath(filepath + ".tmp")
+    {}
+
+    // Destructor
+    ~AcTempFile(){
+      if(!committed) std::remove(temppath.c_str());
+    }
+
+    // Move the finished temporary file over the file being written, on
+    // windows rename() does not replace existing files so the file is
+    // removed first
+    void commit(){
+      #ifdef _WIN32
+      std::remove(filepath.c_str());
+      #endif
+      if(std::rename(temppath.c_str(), filepath.c_str()) != 0){
+        Rcpp::stop("Failed to write file '" + filepath + "'");
+      }
+      committed = true;
+    }
+
+};
+
+#endif
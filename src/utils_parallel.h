@@ -0,0 +1,26 @@
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef Racmacs__utils_parallel__h
+#define Racmacs__utils_parallel__h
+
+// Get the number of threads a parallel region should run on given the number
+// of cores requested, this is at least 1 and never more than the maximum
+// number of threads available to OpenMP
+inline int ac_num_threads(
+    const int &num_cores
+){
+
+  #ifdef _OPENMP
+    return std::max(1, std::min(num_cores, omp_get_max_threads()));
+  #else
+    return 1;
+  #endif
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+
+#include <RcppArmadillo.h>
+#include <cstdint>
+
+#ifndef Racmacs__utils_random__h
+#define Racmacs__utils_random__h
+
+// A counter based random number generator, each number is drawn by hashing
+// the seed, stream and a counter. Streams are independent of each other so
+// they can be drawn from on any thread and in any order with the same results
+class AcRNG {
+
+  private:
+
+    std::uint64_t key;
+    std::uint64_t counter;
+
+    // SplitMix64 finalizer
+    static std::uint64_t mix(
+        std::uint64_t z
+    ){
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+
+  public:
+
+    // Constructor
+    AcRNG(
+      const std::uint64_t &seed,
+      const std::uint64_t &stream
+    ):
+      key(mix(mix(seed + 0x9e3779b97f4a7c15ULL) ^ stream)),
+      counter(0){};
+
+    // Draw the next random 64 bit integer
+    std::uint64_t next(){
+      counter++;
+      return mix(key + counter*0x9e3779b97f4a7c15ULL);
+    }
+
+    // Draw a random number uniformly from [0, 1)
+    double runif(){
+      return (next() >> 11)*(1.0/9007199254740992.0);
+    }
+
+    // Draw a random number uniformly from [min, max)
+    double runif(
+        const double &min,
+        const double &max
+    ){
+      return min + runif()*(max - min);
+    }
+
+    // Draw a random number from a standard normal distribution
+    double rnorm(){
+      double u1 = 1.0 - runif();
+      double u2 = runif();
+      return std::sqrt(-2.0*std::log(u1))*std::cos(2.0*arma::datum::pi*u2);
+    }
+
+    // Draw a random integer from [0, n)
+    arma::uword rint(
+        const arma::uword &n
+    ){
+      return next() % n;
+    }
+
+    // Draw a random sample of k of the integers [0, n) without replacement
+    arma::uvec randperm(
+        const arma::uword &n,
+        const arma::uword &k
+    ){
+      if(n == 0) return arma::uvec();
+      arma::uvec x = arma::regspace<arma::uvec>(0, n - 1);
+      for(arma::uword i=0; i<k; i++){
+        std::swap(x(i), x(i + rint(n - i)));
+      }
+      return x.head(k);
+    }
+
+};
+
+#endif